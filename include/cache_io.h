@@ -0,0 +1,39 @@
+/*  
+ * Copyright 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _CACHE_IO_H_
+#define _CACHE_IO_H_
+
+#include "global.h"
+
+// asynchronous file I/O, used by CacheMng to keep disk operations off the event loop
+// io_uring is used if available, thread pool otherwise
+typedef struct _CacheIO CacheIO;
+
+// called from the event loop, "res" is the number of bytes read / written or -1 on error ("err" is errno)
+typedef void (*CacheIO_on_done_cb) (gpointer ctx, ssize_t res, int err);
+
+CacheIO *cache_io_create (struct event_base *evbase, guint threads);
+// waits for queued operations and calls their callbacks, reads are reported as failed with ECANCELED
+// operations started after destroy is called fail immediately
+void cache_io_destroy (CacheIO *cio);
+
+// "fd" can be closed right after call, "buf" must stay valid until callback is called
+void cache_io_pread (CacheIO *cio, int fd, void *buf, size_t size, off_t off, 
+    CacheIO_on_done_cb on_done_cb, gpointer ctx);
+void cache_io_pwrite (CacheIO *cio, int fd, const void *buf, size_t size, off_t off, 
+    CacheIO_on_done_cb on_done_cb, gpointer ctx);
+
+#endif
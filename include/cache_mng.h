@@ -21,9 +21,23 @@
 CacheMng *cache_mng_create (Application *app);
 void cache_mng_destroy (CacheMng *cmng);
 
-unsigned char *cache_mng_retr_file_data (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off);
+// "buf" is valid only during callback, callback could be called before cache_mng_retr_file_data returns
+typedef void (*CacheMng_on_retrieve_cb) (gpointer ctx, gboolean success, unsigned char *buf, size_t size);
+void cache_mng_retr_file_data (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off, 
+    CacheMng_on_retrieve_cb on_retrieve_cb, gpointer ctx);
+gboolean cache_mng_contain_file_data (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off);
+// return descriptor of cache file which holds the whole range on disk, or -1
+// descriptor is valid only until control returns to event loop
+int cache_mng_get_file_fd (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off);
+// return descriptor of cache file which holds the whole object of "size" bytes on disk, or -1
+int cache_mng_get_backing_fd (CacheMng *cmng, fuse_ino_t ino, guint64 size);
+// return ordered list of HfsRangeSegment: cached and missing parts of requested range
+GList *cache_mng_get_file_ranges (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off);
+// data is copied and written to disk asynchronously
 void cache_mng_store_file_data (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off, unsigned char *buf);
 
 void cache_mng_remove_file_data (CacheMng *cmng, fuse_ino_t ino);
 
+void cache_mng_open_file (CacheMng *cmng, fuse_ino_t ino, const gchar *path, const gchar *etag);
+
 #endif
@@ -27,19 +27,25 @@ typedef struct _DirEntry DirEntry;
 
 DirTree *dir_tree_create (Application *app);
 void dir_tree_destroy (DirTree *dtree);
+// let kernel read completely cached objects directly from cache files (FUSE passthrough)
+void dir_tree_set_passthrough (DirTree *dtree, gboolean enabled);
 
 DirEntry *dir_tree_update_entry (DirTree *dtree, const gchar *path, DirEntryType type, 
-    fuse_ino_t parent_ino, const gchar *entry_name, long long size, time_t last_modified);
+    fuse_ino_t parent_ino, const gchar *entry_name, long long size, time_t last_modified, const gchar *etag);
 
-void dir_tree_start_update (DirTree *dtree, const gchar *dir_path);
-void dir_tree_stop_update (DirTree *dtree, fuse_ino_t parent_ino);
+// directory listing generations, each directory is updated independently
+guint64 dir_tree_start_update (DirTree *dtree, fuse_ino_t ino);
+void dir_tree_stop_update (DirTree *dtree, fuse_ino_t parent_ino, guint64 age, gboolean success);
+// names splitting directory into ranges of the same size, used to list large directories in parallel
+gchar **dir_tree_get_listing_boundaries (DirTree *dtree, fuse_ino_t ino, guint parts, guint min_entries);
 
 typedef void (*dir_tree_readdir_cb) (fuse_req_t req, gboolean success, size_t max_size, off_t off, const char *buf, size_t buf_size);
 void dir_tree_fill_dir_buf (DirTree *dtree, 
-        fuse_ino_t ino, size_t size, off_t off,
+        fuse_ino_t ino, size_t size, off_t off, gboolean plus,
         dir_tree_readdir_cb readdir_cb, fuse_req_t req);
 
-typedef void (*dir_tree_lookup_cb) (fuse_req_t req, gboolean success, fuse_ino_t ino, int mode, off_t file_size, time_t ctime);
+// not_found is set if the entry doesn't exist, otherwise lookup failed
+typedef void (*dir_tree_lookup_cb) (fuse_req_t req, gboolean success, gboolean not_found, fuse_ino_t ino, int mode, off_t file_size, time_t ctime);
 void dir_tree_lookup (DirTree *dtree, fuse_ino_t parent_ino, const char *name,
     dir_tree_lookup_cb lookup_cb, fuse_req_t req);
 
@@ -54,7 +60,7 @@ void dir_tree_setattr (DirTree *dtree, fuse_ino_t ino,
     dir_tree_setattr_cb setattr_cb, fuse_req_t req, void *fi);
 
 
-typedef void (*DirTree_file_read_cb) (fuse_req_t req, gboolean success, const char *buf, size_t buf_size);
+typedef void (*DirTree_file_read_cb) (fuse_req_t req, gboolean success, struct fuse_bufvec *bufv);
 void dir_tree_file_read (DirTree *dtree, fuse_ino_t ino, 
     size_t size, off_t off,
     DirTree_file_read_cb getattr_cb, fuse_req_t req,
@@ -66,14 +72,14 @@ void dir_tree_file_create (DirTree *dtree, fuse_ino_t parent_ino, const char *na
 
 typedef void (*DirTree_file_write_cb) (fuse_req_t req, gboolean success, size_t count);
 void dir_tree_file_write (DirTree *dtree, fuse_ino_t ino, 
-    const char *buf, size_t size, off_t off, 
+    struct fuse_bufvec *bufv, off_t off, 
     DirTree_file_write_cb file_write_cb, fuse_req_t req,
     struct fuse_file_info *fi);
 
 typedef void (*DirTree_file_open_cb) (fuse_req_t req, gboolean success, struct fuse_file_info *fi);
 void dir_tree_file_open (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *fi, DirTree_file_open_cb file_open_cb, fuse_req_t req);
 
-void dir_tree_file_release (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *fi);
+void dir_tree_file_release (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *fi, fuse_req_t req);
 
 typedef void (*DirTree_file_remove_cb) (fuse_req_t req, gboolean success);
 void dir_tree_file_remove (DirTree *dtree, fuse_ino_t ino, DirTree_file_remove_cb file_remove_cb, fuse_req_t req);
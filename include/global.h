@@ -77,8 +77,8 @@
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 
-#define FUSE_USE_VERSION 26
-#include <fuse/fuse_lowlevel.h>
+#define FUSE_USE_VERSION 31
+#include <fuse3/fuse_lowlevel.h>
 
 #include "config.h" 
 
@@ -111,6 +111,7 @@ AuthClient *application_get_auth_client (Application *app);
 HfsEncryption *application_get_encryption (Application *app);
 HfsStatsSrv *application_get_stats_srv (Application *app);
 SSL_CTX *application_get_ssl_ctx (Application *app);
+HfsFuse *application_get_hfs_fuse (Application *app);
 
 #include "log.h" 
 #include "utils.h" 
@@ -0,0 +1,60 @@
+/*  
+ * Copyright 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _HFS_DIR_LIST_PARSER_H_
+#define _HFS_DIR_LIST_PARSER_H_
+
+#include "global.h"
+
+// container listing format, "format" parameter of listing request
+typedef enum {
+    DLF_xml = 0,
+    DLF_json = 1,
+} HfsDirListFormat;
+
+// entry of container listing, strings are valid only during callback
+typedef struct {
+    const gchar *name; // full object name or subdir prefix
+    gboolean is_subdir; // TRUE for <subdir> / "subdir" entry
+    guint64 bytes;
+    const gchar *hash; // object's ETag, NULL if unknown
+    const gchar *content_type; // NULL if unknown
+    time_t last_modified;
+} HfsDirListEntry;
+
+typedef struct _HfsDirListParser HfsDirListParser;
+
+typedef void (*HfsDirListParser_on_entry_cb) (gpointer ctx, const HfsDirListEntry *entry);
+
+HfsDirListParser *hfs_dir_list_parser_create (HfsDirListFormat format,
+    HfsDirListParser_on_entry_cb on_entry_cb, gpointer ctx);
+void hfs_dir_list_parser_destroy (HfsDirListParser *parser);
+
+// parse a part of listing, entries are passed to callback as soon as they are parsed
+// return FALSE if listing is malformed
+gboolean hfs_dir_list_parser_feed (HfsDirListParser *parser, const gchar *buf, size_t buf_len);
+
+// whole listing is fed, return TRUE if it's complete and well-formed
+gboolean hfs_dir_list_parser_finish (HfsDirListParser *parser);
+
+// marker of the next listing page, NULL if the page with "page_entries" entries is the last one
+gchar *hfs_dir_list_next_marker (const gchar *last_name, guint page_entries, guint page_size);
+
+// value of "format" parameter
+const gchar *hfs_dir_list_format_to_string (HfsDirListFormat format);
+// "xml" or "json", XML if unknown
+HfsDirListFormat hfs_dir_list_format_from_string (const gchar *str);
+
+#endif
@@ -23,16 +23,24 @@ typedef struct _HfsFileOp HfsFileOp;
 HfsFileOp *hfs_fileop_create (Application *app, const gchar *fname);
 void hfs_fileop_destroy (HfsFileOp *fop);
 
+void hfs_fileop_set_object_size (HfsFileOp *fop, guint64 size);
+// id of FUSE passthrough backing file, 0 if reads are not passed through
+void hfs_fileop_set_backing_id (HfsFileOp *fop, int backing_id);
+int hfs_fileop_get_backing_id (HfsFileOp *fop);
+
 void hfs_fileop_release (HfsFileOp *fop);
 
 typedef void (*HfsFileOp_on_buffer_written_cb) (HfsFileOp *fop, gpointer ctx, gboolean success, size_t count);
+// data is copied from "bufv" (memory or splice pipe) directly into segment buffer
 void hfs_fileop_write_buffer (HfsFileOp *fop,
-    const char *buf, size_t buf_size, off_t off, fuse_ino_t ino,
+    struct fuse_bufvec *bufv, off_t off, fuse_ino_t ino,
     HfsFileOp_on_buffer_written_cb on_buffer_written_cb, gpointer ctx);
 
-typedef void (*HfsFileOp_on_buffer_read_cb) (gpointer ctx, gboolean success, char *buf, size_t size);
+// data is either in memory or in cache file (descriptor and offset), "bufv" is valid only during callback
+// if FUSE request "req" is interrupted while waiting for download, callback fails and download is cancelled
+typedef void (*HfsFileOp_on_buffer_read_cb) (gpointer ctx, gboolean success, struct fuse_bufvec *bufv);
 void hfs_fileop_read_buffer (HfsFileOp *fop,
-    size_t size, off_t off, fuse_ino_t ino,
+    size_t size, off_t off, fuse_ino_t ino, fuse_req_t req,
     HfsFileOp_on_buffer_read_cb on_buffer_read_cb, gpointer ctx);
 
 #endif
@@ -26,6 +26,10 @@ struct dirbuf {
 HfsFuse *hfs_fuse_new (Application *app, const gchar *mountpoint, const gchar *fuse_opts);
 void hfs_fuse_destroy (HfsFuse *hfs_fuse);
 
-void hfs_fuse_add_dirbuf (fuse_req_t req, struct dirbuf *b, const char *name, fuse_ino_t ino, off_t file_size);
+void hfs_fuse_add_dirbuf (fuse_req_t req, struct dirbuf *b, gboolean plus, const char *name, 
+    fuse_ino_t ino, int mode, off_t file_size, time_t ctime, gboolean attr_valid);
+
+void hfs_fuse_notify_inval_inode (HfsFuse *hfs_fuse, fuse_ino_t ino);
+void hfs_fuse_notify_inval_entry (HfsFuse *hfs_fuse, fuse_ino_t parent_ino, const gchar *name);
 
 #endif
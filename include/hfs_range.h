@@ -27,7 +27,18 @@ void hfs_range_destroy (HfsRange *range);
 void hfs_range_add (HfsRange *range, guint64 start, guint64 end);
 
 gboolean hfs_range_contain (HfsRange *range, guint64 start, guint64 end);
+
+// part of requested range, which is either covered by HfsRange or missing
+typedef struct {
+    guint64 start;
+    guint64 end;
+    gboolean covered;
+} HfsRangeSegment;
+// return ordered list of HfsRangeSegment for [start, end), free with g_list_free_full (l, g_free)
+GList *hfs_range_query (HfsRange *range, guint64 start, guint64 end);
+
 gint hfs_range_count (HfsRange *range);
+guint64 hfs_range_length (HfsRange *range);
 void hfs_range_print (HfsRange *range);
 
 #endif
@@ -31,6 +31,25 @@ guint32 hfs_stats_srv_get_up_speed (HfsStatsSrv *srv);
 void hfs_stats_srv_set_auth_srv_status (HfsStatsSrv *srv, gint code, const gchar *status_line);
 void hfs_stats_srv_set_storage_srv_status (HfsStatsSrv *srv, gint code, const gchar *status_line);
 
+typedef struct {
+    guint64 size; // bytes stored in cache
+    guint64 max_size;
+    guint entries;
+    guint64 cache_hits; // requests served by disk tier
+    guint64 cache_miss;
+    guint64 admissions; // entries added to cache
+    guint64 evictions; // entries removed to keep cache under max size
+    guint64 evicted_bytes;
+    // memory tier
+    guint64 mem_size; // bytes allocated by memory tier
+    guint64 mem_max_size;
+    guint mem_blocks;
+    guint64 mem_hits; // requests served by memory tier
+    guint64 mem_promotions; // blocks copied from disk tier
+    guint64 mem_demotions; // blocks removed to keep memory tier under max size
+} HfsCacheStats;
+void hfs_stats_srv_set_cache_stats (HfsStatsSrv *srv, HfsCacheStats *stats);
+
 void hfs_stats_srv_add_history (HfsStatsSrv *srv, const gchar *url, const gchar *http_method, 
     guint64 bytes, struct timeval *start_tv, struct timeval *end_tv);
 
@@ -47,6 +47,15 @@ struct _HttpConnection {
     gchar *s_status;
     guint64 upload_bytes;
     struct timeval start_tv;
+
+    // request in progress, can be cancelled by high level
+    gpointer pending_req; // ARequest, waiting for AuthData
+    struct evhttp_request *current_req; // sent to server
+    gpointer current_req_data; // RequestData of current_req
+    int response_code; // HTTP code of the last response, 0 if request failed
+
+    // response body callback for the next request
+    gpointer chunk_cb; // HttpConnection_chunk_cb
 };
 
 
@@ -77,6 +86,12 @@ void http_connection_add_output_header (HttpConnection *con, const gchar *key, c
 typedef void (*HttpConnection_response_cb) (HttpConnection *con, gpointer ctx, 
         const gchar *buf, size_t buf_len, struct evkeyvalq *headers, gboolean success);
 
+// response body of the next request is passed to "chunk_cb" as it arrives (only if server replied with 2xx code),
+// response_cb receives only the part of body which is not passed to chunk_cb yet
+typedef void (*HttpConnection_chunk_cb) (HttpConnection *con, gpointer ctx, 
+        const gchar *buf, size_t buf_len);
+void http_connection_set_chunk_cb (HttpConnection *con, HttpConnection_chunk_cb chunk_cb);
+
 // internal
 gboolean http_connection_make_request_ (HttpConnection *con, 
     const gchar *url,
@@ -93,6 +108,10 @@ gboolean http_connection_make_request_to_storage_url (HttpConnection *con,
     HttpConnection_response_cb response_cb,
     gpointer ctx);
 
+// cancel request in progress, its response callback is not called
+// connection is reset if request is already sent, caller releases HttpConnection
+void http_connection_cancel_request (HttpConnection *con);
+
 // get Container metadata information
 typedef void (*HttpConnection_container_meta_cb) (gpointer ctx, gboolean success);
 void http_connection_get_container_meta (HttpConnection *con,
@@ -46,4 +46,5 @@ void timeval_zero (struct timeval *tv);
 
 const gchar *speed_bytes_get_string (guint64 bps);
 const gchar *bytes_get_string (guint64 bytes);
+guint64 bytes_from_string (const gchar *str);
 #endif
@@ -0,0 +1,339 @@
+/*  
+ * Copyright 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "cache_io.h"
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#include <sys/eventfd.h>
+#endif
+
+struct _CacheIO {
+    struct event_base *evbase;
+
+    // thread pool backend
+    GThreadPool *pool;
+    GAsyncQueue *q_done; // CacheIOOp, completed by worker threads
+    int notify_fds[2]; // pipe, workers write to notify event loop about completed operations
+    struct event *ev_notify;
+
+#ifdef HAVE_LIBURING
+    // io_uring backend
+    gboolean uring_enabled;
+    struct io_uring ring;
+    int uring_fd; // eventfd, signaled on completion
+    struct event *ev_uring;
+    struct event *ev_uring_retry; // timer, submits queued operations if io_uring_submit () failed
+#endif
+    guint inflight; // number of submitted operations
+    gboolean destroying; // new operations are rejected, completed reads are reported as cancelled
+};
+
+typedef struct {
+    CacheIO *cio;
+    gboolean write;
+    int fd; // duplicated descriptor, closed when operation is completed
+    void *buf;
+    size_t size;
+    off_t off;
+
+    ssize_t res;
+    int err;
+
+    CacheIO_on_done_cb on_done_cb;
+    gpointer ctx;
+} CacheIOOp;
+
+#define CIO_LOG "cio"
+// io_uring submission queue size
+#define CIO_QUEUE_DEPTH 256
+// delay before submitting queued operations again (microseconds)
+#define CIO_SUBMIT_RETRY_USEC 1000
+
+static void cache_io_worker (gpointer data, gpointer user_data);
+static void cache_io_on_notify_cb (evutil_socket_t fd, short event, void *ctx);
+#ifdef HAVE_LIBURING
+static void cache_io_on_uring_cb (evutil_socket_t fd, short event, void *ctx);
+static void cache_io_on_uring_retry_cb (evutil_socket_t fd, short event, void *ctx);
+#endif
+
+CacheIO *cache_io_create (struct event_base *evbase, guint threads)
+{
+    CacheIO *cio;
+    GError *error = NULL;
+
+    cio = g_new0 (CacheIO, 1);
+    cio->evbase = evbase;
+    cio->inflight = 0;
+    cio->destroying = FALSE;
+
+    if (pipe2 (cio->notify_fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+        LOG_err (CIO_LOG, "Failed to create pipe: %s", strerror (errno));
+        g_free (cio);
+        return NULL;
+    }
+    cio->ev_notify = event_new (evbase, cio->notify_fds[0], EV_READ | EV_PERSIST, cache_io_on_notify_cb, cio);
+    event_add (cio->ev_notify, NULL);
+
+    cio->q_done = g_async_queue_new ();
+    cio->pool = g_thread_pool_new (cache_io_worker, cio, threads ? threads : 1, FALSE, &error);
+    if (!cio->pool) {
+        LOG_err (CIO_LOG, "Failed to create thread pool: %s", error->message);
+        g_error_free (error);
+        cache_io_destroy (cio);
+        return NULL;
+    }
+
+#ifdef HAVE_LIBURING
+    cio->uring_enabled = FALSE;
+    cio->uring_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (cio->uring_fd != -1 && io_uring_queue_init (CIO_QUEUE_DEPTH, &cio->ring, 0) == 0) {
+        if (io_uring_register_eventfd (&cio->ring, cio->uring_fd) == 0) {
+            cio->uring_enabled = TRUE;
+            cio->ev_uring = event_new (evbase, cio->uring_fd, EV_READ | EV_PERSIST, cache_io_on_uring_cb, cio);
+            event_add (cio->ev_uring, NULL);
+            cio->ev_uring_retry = evtimer_new (evbase, cache_io_on_uring_retry_cb, cio);
+        } else {
+            io_uring_queue_exit (&cio->ring);
+        }
+    }
+    if (!cio->uring_enabled) {
+        LOG_debug (CIO_LOG, "io_uring is not available, using thread pool");
+        if (cio->uring_fd != -1)
+            close (cio->uring_fd);
+        cio->uring_fd = -1;
+    }
+#endif
+
+    return cio;
+}
+
+void cache_io_destroy (CacheIO *cio)
+{
+    // callbacks of reads must not continue read paths while application is destroyed
+    cio->destroying = TRUE;
+
+#ifdef HAVE_LIBURING
+    if (cio->uring_enabled) {
+        // wait for submitted operations
+        io_uring_submit (&cio->ring);
+        while (cio->inflight) {
+            struct io_uring_cqe *cqe;
+            if (io_uring_wait_cqe (&cio->ring, &cqe) < 0)
+                break;
+            cache_io_on_uring_cb (cio->uring_fd, EV_READ, cio);
+        }
+        io_uring_queue_exit (&cio->ring);
+        event_free (cio->ev_uring);
+        event_free (cio->ev_uring_retry);
+        close (cio->uring_fd);
+    }
+#endif
+
+    // wait for queued operations
+    if (cio->pool)
+        g_thread_pool_free (cio->pool, FALSE, TRUE);
+    cache_io_on_notify_cb (cio->notify_fds[0], EV_READ, cio);
+
+    g_async_queue_unref (cio->q_done);
+    event_free (cio->ev_notify);
+    close (cio->notify_fds[0]);
+    close (cio->notify_fds[1]);
+    g_free (cio);
+}
+
+static void cache_io_op_done (CacheIOOp *op)
+{
+    CacheIO *cio = op->cio;
+
+    cio->inflight--;
+    close (op->fd);
+    // written data is on disk anyway, the result of write is kept
+    if (cio->destroying && !op->write) {
+        op->res = -1;
+        op->err = ECANCELED;
+    }
+    op->on_done_cb (op->ctx, op->res, op->err);
+    g_free (op);
+}
+
+/*{{{ thread pool */
+// executed by worker thread
+static void cache_io_worker (gpointer data, gpointer user_data)
+{
+    CacheIOOp *op = (CacheIOOp *) data;
+    CacheIO *cio = (CacheIO *) user_data;
+    char c = 0;
+
+    if (op->write)
+        op->res = pwrite (op->fd, op->buf, op->size, op->off);
+    else
+        op->res = pread (op->fd, op->buf, op->size, op->off);
+    op->err = op->res == -1 ? errno : 0;
+
+    g_async_queue_push (cio->q_done, op);
+    // wake up event loop, pipe could be full if event loop is busy: it's fine, event is already pending
+    if (write (cio->notify_fds[1], &c, 1) == -1 && errno != EAGAIN)
+        LOG_err (CIO_LOG, "Failed to notify event loop: %s", strerror (errno));
+}
+
+// operations are completed by worker threads
+static void cache_io_on_notify_cb (evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    CacheIO *cio = (CacheIO *) ctx;
+    CacheIOOp *op;
+    char buf[64];
+
+    while (read (fd, buf, sizeof (buf)) > 0);
+
+    while ((op = (CacheIOOp *) g_async_queue_try_pop (cio->q_done)))
+        cache_io_op_done (op);
+}
+/*}}}*/
+
+#ifdef HAVE_LIBURING
+/*{{{ io_uring */
+
+// submit queued operations, retry later if kernel can't accept them now
+static void cache_io_uring_flush (CacheIO *cio)
+{
+    struct timeval tv = {0, CIO_SUBMIT_RETRY_USEC};
+    int res;
+
+    res = io_uring_submit (&cio->ring);
+    if (res < 0) {
+        LOG_err (CIO_LOG, "Failed to submit operations: %s", strerror (-res));
+        if (!evtimer_pending (cio->ev_uring_retry, NULL))
+            evtimer_add (cio->ev_uring_retry, &tv);
+    }
+}
+
+static void cache_io_on_uring_retry_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    CacheIO *cio = (CacheIO *) ctx;
+
+    cache_io_uring_flush (cio);
+}
+
+// return FALSE if operation is not queued, it must be executed by thread pool
+// once it's queued, it's completed by io_uring only
+static gboolean cache_io_uring_submit (CacheIO *cio, CacheIOOp *op)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = io_uring_get_sqe (&cio->ring);
+    if (!sqe) {
+        // submission queue is full, flush it and retry
+        io_uring_submit (&cio->ring);
+        sqe = io_uring_get_sqe (&cio->ring);
+        if (!sqe)
+            return FALSE;
+    }
+
+    if (op->write)
+        io_uring_prep_write (sqe, op->fd, op->buf, op->size, op->off);
+    else
+        io_uring_prep_read (sqe, op->fd, op->buf, op->size, op->off);
+    io_uring_sqe_set_data (sqe, op);
+
+    // operation stays in submission queue if submit fails
+    cache_io_uring_flush (cio);
+
+    return TRUE;
+}
+
+// eventfd is signaled: reap completed operations
+static void cache_io_on_uring_cb (evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    CacheIO *cio = (CacheIO *) ctx;
+    struct io_uring_cqe *cqe;
+    eventfd_t val;
+
+    eventfd_read (fd, &val);
+
+    while (io_uring_peek_cqe (&cio->ring, &cqe) == 0) {
+        CacheIOOp *op = (CacheIOOp *) io_uring_cqe_get_data (cqe);
+
+        if (cqe->res < 0) {
+            op->res = -1;
+            op->err = -cqe->res;
+        } else {
+            op->res = cqe->res;
+            op->err = 0;
+        }
+        io_uring_cqe_seen (&cio->ring, cqe);
+
+        cache_io_op_done (op);
+    }
+}
+/*}}}*/
+#endif
+
+static void cache_io_submit (CacheIO *cio, gboolean write_op, int fd, void *buf, size_t size, off_t off, 
+    CacheIO_on_done_cb on_done_cb, gpointer ctx)
+{
+    CacheIOOp *op;
+    GError *error = NULL;
+
+    // called by a callback of operation completed in cache_io_destroy ()
+    if (cio->destroying) {
+        on_done_cb (ctx, -1, ECANCELED);
+        return;
+    }
+
+    op = g_new0 (CacheIOOp, 1);
+    op->cio = cio;
+    op->write = write_op;
+    op->buf = buf;
+    op->size = size;
+    op->off = off;
+    op->on_done_cb = on_done_cb;
+    op->ctx = ctx;
+
+    // caller is free to close its descriptor
+    op->fd = dup (fd);
+    if (op->fd == -1) {
+        LOG_err (CIO_LOG, "Failed to duplicate file descriptor: %s", strerror (errno));
+        on_done_cb (ctx, -1, errno);
+        g_free (op);
+        return;
+    }
+
+    cio->inflight++;
+
+#ifdef HAVE_LIBURING
+    if (cio->uring_enabled && cache_io_uring_submit (cio, op))
+        return;
+#endif
+
+    if (!g_thread_pool_push (cio->pool, op, &error)) {
+        LOG_err (CIO_LOG, "Failed to queue operation: %s", error->message);
+        g_error_free (error);
+        op->res = -1;
+        op->err = EAGAIN;
+        cache_io_op_done (op);
+    }
+}
+
+void cache_io_pread (CacheIO *cio, int fd, void *buf, size_t size, off_t off, 
+    CacheIO_on_done_cb on_done_cb, gpointer ctx)
+{
+    cache_io_submit (cio, FALSE, fd, buf, size, off, on_done_cb, ctx);
+}
+
+void cache_io_pwrite (CacheIO *cio, int fd, const void *buf, size_t size, off_t off, 
+    CacheIO_on_done_cb on_done_cb, gpointer ctx)
+{
+    cache_io_submit (cio, TRUE, fd, (void *) buf, size, off, on_done_cb, ctx);
+}
@@ -14,33 +14,117 @@
  * limitations under the License.
 */
 #include "cache_mng.h"
+#include "cache_io.h"
 #include "hfs_range.h"
+#include "hfs_stats_srv.h"
 
 struct _CacheMng {
     Application *app;
     ConfData *conf;
 
     GHashTable *h_files; // ino -> CacheEntry
+    // persistent cache
+    gboolean persistent; // TRUE if cache is kept between mounts
+    GHashTable *h_records; // object path -> CacheEntry, entries loaded from index and not opened yet
+    GHashTable *h_paths; // object path -> CacheEntry, all entries which belong to an object (not owned)
+    gboolean index_modified; // TRUE if index must be saved
+    gboolean keep_files; // TRUE if destroyed entries must keep their files
 
-    guint64 cache_hits;
+    // segmented LRU: entries are admitted to probationary segment,
+    // moved to protected segment on the first cache hit
+    GQueue *q_probation; // CacheEntry, most recently used is the head
+    GQueue *q_protected; // CacheEntry, most recently used is the head
+    guint64 protected_size; // bytes in protected segment
+    guint64 size; // total bytes stored in cache
+    guint64 max_size; // filesystem.cache_dir_max_size
+
+    // memory tier: recently used blocks of disk cache entries
+    GHashTable *h_mem_blocks; // MemBlockKey -> MemBlock
+    GQueue *q_mem; // MemBlock, most recently used is the head
+    guint64 mem_size; // bytes allocated by memory tier
+    guint64 mem_max_size; // filesystem.cache_memory_size
+
+    CacheIO *cio; // disk I/O is done outside of event loop
+
+    // entries attached to inodes, ordered by access time: least recently accessed is the head
+    // all entries have the same TTL, so the head is always the first to expire
+    GQueue *q_expiry;
+    guint object_ttl; // filesystem.cache_object_ttl
+
+    HfsCacheStats stats; // counters exported to HfsStatsSrv
 
     struct event *timeout;
 };
 
 typedef struct {
     CacheMng *cmng;
+    fuse_ino_t ino; // 0 if entry is loaded from index, but object is not opened yet
     int fd; //rw
     gchar *fname;
+    gchar *path; // object path, NULL if entry is not persistent
+    gchar *etag; // object version
     time_t create_time;
     time_t atime;
 
     HfsRange *range;
+    HfsRange *persisted; // part of "range" which is written to file, only it is saved to index
+    guint64 size; // bytes stored in file
+    GList *lru_link; // link in one of SLRU queues
+    gboolean is_protected; // TRUE if entry is in protected segment
+    GList *expiry_link; // link in q_expiry, NULL if entry is not attached to inode
+    GList *l_mem_blocks; // MemBlock, blocks promoted to memory tier
+    GList *l_ops; // CacheMngOp, disk operations in progress
 } CacheEntry;
 
+// asynchronous read or write of cache file
+typedef struct {
+    CacheMng *cmng;
+    CacheEntry *en; // NULL if entry was removed while operation is in progress
+    gboolean write;
+    unsigned char *buf;
+    size_t size;
+    off_t off;
+
+    // read of range which overlaps pending writes:
+    // their data is copied to "buf" when read starts, the rest is read from disk to "disk_buf"
+    HfsRange *pending; // parts of "buf" taken from pending writes, offsets are relative to "off"
+    unsigned char *disk_buf;
+
+    CacheMng_on_retrieve_cb on_retrieve_cb;
+    gpointer ctx;
+} CacheMngOp;
+
+typedef struct {
+    fuse_ino_t ino;
+    guint64 index; // block number, offset / CMNG_MEM_BLOCK_SIZE
+} MemBlockKey;
+
+typedef struct {
+    MemBlockKey key;
+    CacheEntry *en;
+    unsigned char *data;
+    size_t len; // valid bytes from the beginning of block
+    GList *lru_link; // link in q_mem
+} MemBlock;
+
 static void cache_entry_destroy (CacheEntry *en);
+static void cache_mng_update_stats (CacheMng *cmng);
 static void cache_mng_on_cache_check_cb (evutil_socket_t fd, short event, void *ctx);
 
 #define CMNG_LOG "cmng"
+// max share (%) of cache size used by protected segment
+#define CMNG_PROTECTED_PERCENT 80
+// name of persistent cache index file
+#define CMNG_INDEX_FILE "cache.index"
+// size of memory tier block
+#define CMNG_MEM_BLOCK_SIZE (128 * 1024)
+
+static void cache_mng_load_index (CacheMng *cmng);
+static void cache_mng_save_index (CacheMng *cmng);
+static void cache_mng_lru_evict (CacheMng *cmng);
+static guint mem_block_hash (gconstpointer v);
+static gboolean mem_block_equal (gconstpointer v1, gconstpointer v2);
+static void cache_mng_mem_drop (CacheMng *cmng, CacheEntry *en);
 
 CacheMng *cache_mng_create (Application *app)
 {
@@ -51,10 +135,31 @@ CacheMng *cache_mng_create (Application *app)
     cmng->app = app;
     cmng->conf = application_get_conf (app);
     cmng->h_files = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)cache_entry_destroy);
-    cmng->cache_hits = 0;
+    cmng->q_probation = g_queue_new ();
+    cmng->q_protected = g_queue_new ();
+    cmng->protected_size = 0;
+    cmng->size = 0;
+    cmng->max_size = bytes_from_string (conf_get_string (cmng->conf, "filesystem.cache_dir_max_size"));
+    cmng->persistent = conf_get_boolean (cmng->conf, "filesystem.cache_persistent");
+    cmng->h_records = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify)cache_entry_destroy);
+    cmng->h_paths = g_hash_table_new (g_str_hash, g_str_equal);
+    cmng->index_modified = FALSE;
+    cmng->keep_files = FALSE;
+    cmng->q_expiry = g_queue_new ();
+    cmng->object_ttl = conf_get_uint (cmng->conf, "filesystem.cache_object_ttl");
+    cmng->h_mem_blocks = g_hash_table_new (mem_block_hash, mem_block_equal);
+    cmng->q_mem = g_queue_new ();
+    cmng->mem_size = 0;
+    cmng->mem_max_size = bytes_from_string (conf_get_string (cmng->conf, "filesystem.cache_memory_size"));
+    cmng->cio = cache_io_create (application_get_evbase (app), conf_get_uint (cmng->conf, "filesystem.cache_io_threads"));
+    if (!cmng->cio) {
+        LOG_err (CMNG_LOG, "Failed to create cache I/O !");
+        return NULL;
+    }
 
     // free cache directory
-    utils_del_tree (conf_get_string (cmng->conf, "filesystem.cache_dir"));
+    if (!cmng->persistent)
+        utils_del_tree (conf_get_string (cmng->conf, "filesystem.cache_dir"));
 
     // make sure cache directory exists and is accessible 
     if (g_access (conf_get_string (cmng->conf, "filesystem.cache_dir"), F_OK | W_OK) == -1) {
@@ -67,6 +172,9 @@ CacheMng *cache_mng_create (Application *app)
             return NULL;
         }
     }
+
+    if (cmng->persistent)
+        cache_mng_load_index (cmng);
     
     cmng->timeout = evtimer_new (application_get_evbase (app), cache_mng_on_cache_check_cb, cmng);
     // start event
@@ -79,39 +187,85 @@ CacheMng *cache_mng_create (Application *app)
 
 void cache_mng_destroy (CacheMng *cmng)
 {
-    // clean
-    utils_del_tree (conf_get_string (cmng->conf, "filesystem.cache_dir"));
+    // complete pending disk operations
+    cache_io_destroy (cmng->cio);
+
+    if (cmng->persistent) {
+        cache_mng_save_index (cmng);
+        cmng->keep_files = TRUE;
+    } else {
+        // clean
+        utils_del_tree (conf_get_string (cmng->conf, "filesystem.cache_dir"));
+    }
     
     g_hash_table_destroy (cmng->h_files);
+    g_hash_table_destroy (cmng->h_records);
+    g_hash_table_destroy (cmng->h_paths);
+    g_hash_table_destroy (cmng->h_mem_blocks);
+    g_queue_free (cmng->q_mem);
+    g_queue_free (cmng->q_expiry);
+    g_queue_free (cmng->q_probation);
+    g_queue_free (cmng->q_protected);
     g_free (cmng);
 }
 
-// return TRUE if entry should be removed
-static gboolean cache_mng_on_remove_file_cb (gpointer key, gpointer value, G_GNUC_UNUSED gpointer ctx)
+// entry is accessed: update access time and move it to the tail of expiry queue
+static void cache_mng_expiry_touch (CacheMng *cmng, CacheEntry *en)
 {
-    // CacheMng *cmng = (CacheMng *) ctx;
-    CacheEntry *en = (CacheEntry *) value;
-    fuse_ino_t ino = GPOINTER_TO_UINT (key);
-    time_t now = time (NULL);
+    en->atime = time (NULL);
 
-    if (now > en->atime && now - en->atime >= conf_get_uint (en->cmng->conf, "filesystem.cache_object_ttl")) {
-        LOG_debug (CMNG_LOG, "Object expired, ino: %"INO_FMT, INO ino);
-        return TRUE;
+    if (en->expiry_link) {
+        g_queue_unlink (cmng->q_expiry, en->expiry_link);
+        g_queue_push_tail_link (cmng->q_expiry, en->expiry_link);
+    } else {
+        g_queue_push_tail (cmng->q_expiry, en);
+        en->expiry_link = g_queue_peek_tail_link (cmng->q_expiry);
     }
+}
 
-    return FALSE;
+static void cache_mng_expiry_remove (CacheMng *cmng, CacheEntry *en)
+{
+    if (en->expiry_link) {
+        g_queue_delete_link (cmng->q_expiry, en->expiry_link);
+        en->expiry_link = NULL;
+    }
 }
 
-// on timer, check objects in cache to remove expired
+// on timer, remove expired objects from the head of expiry queue
 static void cache_mng_on_cache_check_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
 {
     struct timeval tv;
     CacheMng *cmng = (CacheMng *) ctx;
-    guint count;
+    CacheEntry *en;
+    guint count = 0;
+    time_t now = time (NULL);
 
     LOG_debug (CMNG_LOG, "Checking for expired cached objects");
-    count = g_hash_table_foreach_remove (cmng->h_files, cache_mng_on_remove_file_cb, cmng);
+    while ((en = (CacheEntry *) g_queue_peek_head (cmng->q_expiry)) && 
+        now > en->atime && (guint64)(now - en->atime) >= cmng->object_ttl) {
+
+        LOG_debug (CMNG_LOG, "Object expired, ino: %"INO_FMT, INO en->ino);
+        count++;
+
+        // keep persistent entry on disk until it's opened again
+        if (en->path) {
+            cache_mng_expiry_remove (cmng, en);
+            cache_mng_mem_drop (cmng, en);
+            g_hash_table_steal (cmng->h_files, GUINT_TO_POINTER (en->ino));
+            en->ino = 0;
+            if (en->fd != -1)
+                close (en->fd);
+            en->fd = -1;
+            g_hash_table_insert (cmng->h_records, en->path, en);
+        } else {
+            g_hash_table_remove (cmng->h_files, GUINT_TO_POINTER (en->ino));
+        }
+    }
     LOG_debug (CMNG_LOG, "Objects removed: %u", count);
+    cache_mng_update_stats (cmng);
+
+    if (cmng->index_modified)
+        cache_mng_save_index (cmng);
 
     // restart event
     evutil_timerclear (&tv);
@@ -119,20 +273,76 @@ static void cache_mng_on_cache_check_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNU
     event_add (cmng->timeout, &tv);
 }
 
-static CacheEntry *cache_entry_create (CacheMng *cmng, fuse_ino_t ino)
+// persistent cache file name is based on object path
+static gchar *cache_mng_get_file_name (CacheMng *cmng, fuse_ino_t ino, const gchar *path)
+{
+    gchar *fname;
+    gchar *md5;
+
+    if (!path)
+        return g_strdup_printf ("%s/%"INO_FMT, conf_get_string (cmng->conf, "filesystem.cache_dir"), INO ino);
+
+    md5 = g_compute_checksum_for_string (G_CHECKSUM_MD5, path, -1);
+    fname = g_strdup_printf ("%s/%s", conf_get_string (cmng->conf, "filesystem.cache_dir"), md5);
+    g_free (md5);
+
+    return fname;
+}
+
+// TRUE if file name is MD5 of object path, see cache_mng_get_file_name ()
+static gboolean cache_mng_is_cache_file_name (const gchar *name)
+{
+    gint i;
+
+    for (i = 0; name[i]; i++) {
+        if (!g_ascii_isxdigit (name[i]) || g_ascii_isupper (name[i]))
+            return FALSE;
+    }
+
+    return i == 32;
+}
+
+static gboolean cache_entry_open (CacheEntry *en)
+{
+    if (en->fd != -1)
+        return TRUE;
+
+    en->fd = open (en->fname, O_RDWR | O_NOATIME | O_LARGEFILE | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IXUSR);
+    if (en->fd == -1) {
+        LOG_err (CMNG_LOG, "Failed to create file %s for read-write: %s", en->fname, strerror (errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// path is NULL for not persistent entries
+static CacheEntry *cache_entry_create (CacheMng *cmng, fuse_ino_t ino, const gchar *path, const gchar *etag)
 {
     CacheEntry *en;
 
     en = g_new0 (CacheEntry, 1);
     en->cmng = cmng;
-    en->fname = g_strdup_printf ("%s/%"INO_FMT, conf_get_string (cmng->conf, "filesystem.cache_dir"), INO ino);
+    en->ino = ino;
+    en->size = 0;
+    en->lru_link = NULL;
+    en->is_protected = FALSE;
+    en->l_mem_blocks = NULL;
+    en->l_ops = NULL;
+    en->expiry_link = NULL;
+    en->path = g_strdup (path);
+    en->etag = g_strdup (etag);
+    en->fname = cache_mng_get_file_name (cmng, ino, path);
     en->create_time = en->atime = time (NULL);
     en->fd = -1;
     en->range = hfs_range_create ();
+    en->persisted = hfs_range_create ();
 
-    en->fd = open (en->fname, O_RDWR | O_NOATIME | O_LARGEFILE | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IXUSR);
-    if (en->fd == -1) {
-        LOG_err (CMNG_LOG, "Failed to create file %s for read-write: %s", en->fname, strerror (errno));
+    // entry loaded from index, file is opened when object is opened
+    if (!ino)
+        return en;
+
+    if (!cache_entry_open (en)) {
         cache_entry_destroy (en);
         return NULL;
     }
@@ -142,83 +352,648 @@ static CacheEntry *cache_entry_create (CacheMng *cmng, fuse_ino_t ino)
 
 static void cache_entry_destroy (CacheEntry *en)
 {
+    CacheMng *cmng = en->cmng;
+    GList *l;
+
+    cache_mng_mem_drop (cmng, en);
+    cache_mng_expiry_remove (cmng, en);
+
+    // operations in progress are completed without entry
+    for (l = g_list_first (en->l_ops); l; l = g_list_next (l))
+        ((CacheMngOp *) l->data)->en = NULL;
+    g_list_free (en->l_ops);
+
+    // remove from SLRU
+    if (en->lru_link) {
+        if (en->is_protected) {
+            g_queue_delete_link (cmng->q_protected, en->lru_link);
+            cmng->protected_size -= en->size;
+        } else {
+            g_queue_delete_link (cmng->q_probation, en->lru_link);
+        }
+    }
+    cmng->size -= en->size;
+
+    if (en->path) {
+        if (g_hash_table_lookup (cmng->h_paths, en->path) == en)
+            g_hash_table_remove (cmng->h_paths, en->path);
+        cmng->index_modified = TRUE;
+    }
+
     hfs_range_destroy (en->range);
-    g_free (en->fname);
+    hfs_range_destroy (en->persisted);
     if (en->fd != -1)
         close (en->fd);
+    // free disk space
+    if (!cmng->keep_files || !en->path)
+        unlink (en->fname);
+    g_free (en->fname);
+    g_free (en->path);
+    g_free (en->etag);
     g_free (en);
 }
 
-unsigned char *cache_mng_retr_file_data (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off)
+// remove entry from cache and delete its file
+static void cache_mng_remove_entry (CacheMng *cmng, CacheEntry *en)
+{
+    if (en->ino)
+        g_hash_table_remove (cmng->h_files, GUINT_TO_POINTER (en->ino));
+    else
+        g_hash_table_remove (cmng->h_records, en->path);
+}
+
+// add a new entry to the probationary segment
+static void cache_mng_add_entry (CacheMng *cmng, CacheEntry *en)
+{
+    if (en->ino) {
+        g_hash_table_insert (cmng->h_files, GUINT_TO_POINTER (en->ino), en);
+        cache_mng_expiry_touch (cmng, en);
+    } else
+        g_hash_table_insert (cmng->h_records, en->path, en);
+    if (en->path) {
+        g_hash_table_insert (cmng->h_paths, en->path, en);
+        cmng->index_modified = TRUE;
+    }
+
+    g_queue_push_head (cmng->q_probation, en);
+    en->lru_link = g_queue_peek_head_link (cmng->q_probation);
+    cmng->size += en->size;
+}
+
+/*{{{ SLRU */
+// entry is accessed (cache hit), move it to the head of protected segment
+static void cache_mng_lru_hit (CacheMng *cmng, CacheEntry *en)
+{
+    if (en->is_protected) {
+        g_queue_unlink (cmng->q_protected, en->lru_link);
+        g_queue_push_head_link (cmng->q_protected, en->lru_link);
+        return;
+    }
+
+    g_queue_delete_link (cmng->q_probation, en->lru_link);
+    g_queue_push_head (cmng->q_protected, en);
+    en->lru_link = g_queue_peek_head_link (cmng->q_protected);
+    en->is_protected = TRUE;
+    cmng->protected_size += en->size;
+
+    // protected segment is full, demote the least recently used entries to probationary segment
+    while (cmng->max_size && cmng->protected_size > cmng->max_size / 100 * CMNG_PROTECTED_PERCENT && 
+        g_queue_get_length (cmng->q_protected) > 1) {
+        CacheEntry *tmp = (CacheEntry *) g_queue_pop_tail (cmng->q_protected);
+
+        cmng->protected_size -= tmp->size;
+        tmp->is_protected = FALSE;
+        g_queue_push_head (cmng->q_probation, tmp);
+        tmp->lru_link = g_queue_peek_head_link (cmng->q_probation);
+    }
+}
+
+// remove the least recently used entries until cache fits into max size
+// entries from probationary segment are removed first
+static void cache_mng_lru_evict (CacheMng *cmng)
+{
+    CacheEntry *en;
+
+    while (cmng->max_size && cmng->size > cmng->max_size) {
+        en = (CacheEntry *) g_queue_peek_tail (cmng->q_probation);
+        if (!en)
+            en = (CacheEntry *) g_queue_peek_tail (cmng->q_protected);
+        if (!en)
+            break;
+
+        LOG_debug (CMNG_LOG, "Evicting ino: %"INO_FMT", size: %"G_GUINT64_FORMAT, INO en->ino, en->size);
+        cmng->stats.evictions++;
+        cmng->stats.evicted_bytes += en->size;
+        cache_mng_remove_entry (cmng, en);
+    }
+}
+/*}}}*/
+
+/*{{{ memory tier */
+// blocks are promoted from disk tier on disk cache hit and demoted (dropped from memory,
+// data stays in disk tier) when memory tier is full
+static guint mem_block_hash (gconstpointer v)
+{
+    const MemBlockKey *key = (const MemBlockKey *) v;
+
+    return (guint) (key->ino * 2654435761U) ^ (guint) key->index;
+}
+
+static gboolean mem_block_equal (gconstpointer v1, gconstpointer v2)
+{
+    const MemBlockKey *key1 = (const MemBlockKey *) v1;
+    const MemBlockKey *key2 = (const MemBlockKey *) v2;
+
+    return key1->ino == key2->ino && key1->index == key2->index;
+}
+
+static void cache_mng_mem_remove_block (CacheMng *cmng, MemBlock *b)
+{
+    g_hash_table_remove (cmng->h_mem_blocks, &b->key);
+    g_queue_delete_link (cmng->q_mem, b->lru_link);
+    b->en->l_mem_blocks = g_list_remove (b->en->l_mem_blocks, b);
+    cmng->mem_size -= CMNG_MEM_BLOCK_SIZE;
+
+    g_free (b->data);
+    g_free (b);
+}
+
+// remove all entry's blocks from memory tier
+static void cache_mng_mem_drop (CacheMng *cmng, CacheEntry *en)
+{
+    while (en->l_mem_blocks)
+        cache_mng_mem_remove_block (cmng, (MemBlock *) en->l_mem_blocks->data);
+}
+
+// remove blocks overlapping with the range, data could be overwritten
+static void cache_mng_mem_invalidate (CacheMng *cmng, CacheEntry *en, size_t size, off_t off)
+{
+    MemBlockKey key;
+    MemBlock *b;
+    guint64 last;
+
+    if (!en->l_mem_blocks || !size)
+        return;
+
+    last = (off + size - 1) / CMNG_MEM_BLOCK_SIZE;
+    key.ino = en->ino;
+    for (key.index = off / CMNG_MEM_BLOCK_SIZE; key.index <= last; key.index++) {
+        b = g_hash_table_lookup (cmng->h_mem_blocks, &key);
+        if (b)
+            cache_mng_mem_remove_block (cmng, b);
+    }
+}
+
+// return newly allocated buffer if all requested bytes are in memory tier, NULL otherwise
+// return TRUE if all requested bytes are in memory tier
+static gboolean cache_mng_mem_contain (CacheMng *cmng, CacheEntry *en, size_t size, off_t off)
+{
+    MemBlockKey key;
+    MemBlock *b;
+    guint64 first, last;
+
+    if (!cmng->mem_max_size || !en->l_mem_blocks || !size)
+        return FALSE;
+
+    first = off / CMNG_MEM_BLOCK_SIZE;
+    last = (off + size - 1) / CMNG_MEM_BLOCK_SIZE;
+    key.ino = en->ino;
+
+    for (key.index = first; key.index <= last; key.index++) {
+        guint64 block_start = key.index * CMNG_MEM_BLOCK_SIZE;
+        guint64 end = MIN ((guint64)off + size, block_start + CMNG_MEM_BLOCK_SIZE);
+
+        b = g_hash_table_lookup (cmng->h_mem_blocks, &key);
+        if (!b || block_start + b->len < end)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static unsigned char *cache_mng_mem_retr (CacheMng *cmng, CacheEntry *en, size_t size, off_t off)
+{
+    MemBlockKey key;
+    MemBlock *b;
+    guint64 first, last;
+    unsigned char *buf;
+    size_t copied = 0;
+
+    // make sure all blocks are present
+    if (!cache_mng_mem_contain (cmng, en, size, off))
+        return NULL;
+
+    first = off / CMNG_MEM_BLOCK_SIZE;
+    last = (off + size - 1) / CMNG_MEM_BLOCK_SIZE;
+    key.ino = en->ino;
+
+    buf = g_new (unsigned char, size);
+    for (key.index = first; key.index <= last; key.index++) {
+        guint64 block_start = key.index * CMNG_MEM_BLOCK_SIZE;
+        guint64 start = MAX ((guint64)off, block_start);
+        guint64 end = MIN ((guint64)off + size, block_start + CMNG_MEM_BLOCK_SIZE);
+
+        b = g_hash_table_lookup (cmng->h_mem_blocks, &key);
+        memcpy (buf + copied, b->data + (start - block_start), end - start);
+        copied += end - start;
+
+        g_queue_unlink (cmng->q_mem, b->lru_link);
+        g_queue_push_head_link (cmng->q_mem, b->lru_link);
+    }
+
+    return buf;
+}
+
+// copy blocks touched by the request to memory tier, "buf" contains data read from disk tier
+static void cache_mng_mem_promote (CacheMng *cmng, CacheEntry *en, unsigned char *buf, size_t size, off_t off)
+{
+    MemBlockKey key;
+    MemBlock *b;
+    guint64 first, last;
+
+    if (!cmng->mem_max_size || cmng->mem_max_size < CMNG_MEM_BLOCK_SIZE || !size || !en->ino)
+        return;
+
+    first = off / CMNG_MEM_BLOCK_SIZE;
+    last = (off + size - 1) / CMNG_MEM_BLOCK_SIZE;
+    key.ino = en->ino;
+
+    for (key.index = first; key.index <= last; key.index++) {
+        guint64 block_start = key.index * CMNG_MEM_BLOCK_SIZE;
+        guint64 start = MAX ((guint64)off, block_start);
+        guint64 end = MIN ((guint64)off + size, block_start + CMNG_MEM_BLOCK_SIZE);
+
+        b = g_hash_table_lookup (cmng->h_mem_blocks, &key);
+
+        // block must be filled from its beginning
+        if (start > block_start + (b ? b->len : 0))
+            continue;
+        // nothing new
+        if (b && block_start + b->len >= end)
+            continue;
+
+        if (!b) {
+            b = g_new0 (MemBlock, 1);
+            b->key = key;
+            b->en = en;
+            b->data = g_new (unsigned char, CMNG_MEM_BLOCK_SIZE);
+
+            g_hash_table_insert (cmng->h_mem_blocks, &b->key, b);
+            g_queue_push_head (cmng->q_mem, b);
+            b->lru_link = g_queue_peek_head_link (cmng->q_mem);
+            en->l_mem_blocks = g_list_prepend (en->l_mem_blocks, b);
+            cmng->mem_size += CMNG_MEM_BLOCK_SIZE;
+            cmng->stats.mem_promotions++;
+        }
+
+        memcpy (b->data + (start - block_start), buf + (start - off), end - start);
+        b->len = end - block_start;
+    }
+
+    // demote the least recently used blocks
+    while (cmng->mem_size > cmng->mem_max_size) {
+        b = (MemBlock *) g_queue_peek_tail (cmng->q_mem);
+        if (!b)
+            break;
+        cache_mng_mem_remove_block (cmng, b);
+        cmng->stats.mem_demotions++;
+    }
+}
+/*}}}*/
+
+// "res" bytes are read from disk, fill parts of buffer which were not taken from pending writes
+// return FALSE if file doesn't have all of them
+static gboolean cache_mng_read_merge (CacheMngOp *op, ssize_t res)
+{
+    GList *l_segments, *l;
+    gboolean ok = TRUE;
+
+    if (!op->pending)
+        return (size_t)res == op->size;
+
+    l_segments = hfs_range_query (op->pending, 0, op->size);
+    for (l = g_list_first (l_segments); l; l = g_list_next (l)) {
+        HfsRangeSegment *seg = (HfsRangeSegment *) l->data;
+
+        if (seg->covered)
+            continue;
+        if (seg->end > (guint64)res) {
+            ok = FALSE;
+            break;
+        }
+        memcpy (op->buf + seg->start, op->disk_buf + seg->start, seg->end - seg->start);
+    }
+    g_list_free_full (l_segments, g_free);
+
+    return ok;
+}
+
+static void cache_mng_on_read_cb (gpointer ctx, ssize_t res, int err)
+{
+    CacheMngOp *op = (CacheMngOp *) ctx;
+    CacheMng *cmng = op->cmng;
+    CacheEntry *en = op->en;
+
+    if (en)
+        en->l_ops = g_list_remove (en->l_ops, op);
+
+    if (!en) {
+        // object was changed or evicted while reading
+        LOG_debug (CMNG_LOG, "Cached object was removed, read is discarded");
+        cmng->stats.cache_miss++;
+        op->on_retrieve_cb (op->ctx, FALSE, NULL, 0);
+    } else if (res == -1) {
+        LOG_debug (CMNG_LOG, "Failed to read from file %s : %s", en->fname, strerror (err));
+        op->on_retrieve_cb (op->ctx, FALSE, NULL, 0);
+    } else if (!cache_mng_read_merge (op, res)) {
+        LOG_debug (CMNG_LOG, "File doesn't have requested bytes range %s", en->fname);
+        op->on_retrieve_cb (op->ctx, FALSE, NULL, 0);
+    } else {
+        LOG_debug (CMNG_LOG, "Retrieved [%zu %zu] bytes for ino: %"INO_FMT, op->off, op->off + op->size, INO en->ino);
+        cmng->stats.cache_hits++;
+        cache_mng_lru_hit (cmng, en);
+        cache_mng_mem_promote (cmng, en, op->buf, op->size, op->off);
+        op->on_retrieve_cb (op->ctx, TRUE, op->buf, op->size);
+    }
+
+    cache_mng_update_stats (cmng);
+    if (op->pending)
+        hfs_range_destroy (op->pending);
+    g_free (op->disk_buf);
+    g_free (op->buf);
+    g_free (op);
+}
+
+// copy bytes of pending writes, which overlap requested range, to "buf" and add them to "pending"
+// writes are applied in the order they were issued
+// return TRUE if the whole range is taken from pending writes
+static gboolean cache_mng_get_pending_data (CacheEntry *en, unsigned char *buf, size_t size, off_t off, HfsRange *pending)
+{
+    GList *l;
+
+    for (l = g_list_first (en->l_ops); l; l = g_list_next (l)) {
+        CacheMngOp *op = (CacheMngOp *) l->data;
+        off_t start, end;
+
+        if (!op->write || op->off >= (off_t)(off + size) || off >= (off_t)(op->off + op->size))
+            continue;
+
+        start = MAX (off, op->off);
+        end = MIN ((off_t)(off + size), (off_t)(op->off + op->size));
+        memcpy (buf + (start - off), op->buf + (start - op->off), end - start);
+        hfs_range_add (pending, start - off, end - off);
+    }
+
+    return hfs_range_contain (pending, 0, size);
+}
+
+// return TRUE if any byte of requested range is not written to disk yet
+static gboolean cache_mng_has_pending_write (CacheEntry *en, size_t size, off_t off)
+{
+    GList *l;
+
+    for (l = g_list_first (en->l_ops); l; l = g_list_next (l)) {
+        CacheMngOp *op = (CacheMngOp *) l->data;
+
+        if (op->write && op->off < (off_t)(off + size) && off < (off_t)(op->off + op->size))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+void cache_mng_retr_file_data (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off, 
+    CacheMng_on_retrieve_cb on_retrieve_cb, gpointer ctx)
 {
     CacheEntry *en;
     unsigned char *buf = NULL;
-    ssize_t out_size;
+    HfsRange *pending = NULL;
+    CacheMngOp *op;
 
     if (!conf_get_boolean (cmng->conf, "filesystem.cache_enabled")) {
-        return NULL;
+        on_retrieve_cb (ctx, FALSE, NULL, 0);
+        return;
     }
 
     en = g_hash_table_lookup (cmng->h_files, GUINT_TO_POINTER (ino));
     if (!en) {
-        return NULL;
+        cmng->stats.cache_miss++;
+        cache_mng_update_stats (cmng);
+        on_retrieve_cb (ctx, FALSE, NULL, 0);
+        return;
     }
     // update access time
-    en->atime = time (NULL);
+    cache_mng_expiry_touch (cmng, en);
+
+    buf = cache_mng_mem_retr (cmng, en, size, off);
+    if (buf) {
+        LOG_debug (CMNG_LOG, "Retrieved [%zu %zu] bytes from memory for ino: %"INO_FMT, off, off + size, INO ino);
+        cmng->stats.mem_hits++;
+        cache_mng_lru_hit (cmng, en);
+        cache_mng_update_stats (cmng);
+        on_retrieve_cb (ctx, TRUE, buf, size);
+        g_free (buf);
+        return;
+    }
 
     // check if we have range
     if (!hfs_range_contain (en->range, off, off + size)) {
-        hfs_range_print (en->range);
         LOG_debug (CMNG_LOG, "File doesn't have requested bytes [%zu %zu]  for ino: %"INO_FMT, off, off + size, INO ino);
-        return NULL;
+        cmng->stats.cache_miss++;
+        cache_mng_update_stats (cmng);
+        on_retrieve_cb (ctx, FALSE, NULL, 0);
+        return;
     }
 
     buf = g_new0 (unsigned char, size);
-    out_size = pread (en->fd, buf, size, off);
-    if (out_size == -1) {
-        LOG_debug (CMNG_LOG, "Failed to read from file %s : %s", en->fname, strerror (errno));
-        g_free (buf);
-        return NULL;
+
+    // data is not written to disk yet:
+    // disk read can be executed before pending writes, their data is taken from write buffers
+    if (cache_mng_has_pending_write (en, size, off)) {
+        pending = hfs_range_create ();
+        if (cache_mng_get_pending_data (en, buf, size, off, pending)) {
+            LOG_debug (CMNG_LOG, "Retrieved [%zu %zu] bytes from pending write for ino: %"INO_FMT, off, off + size, INO ino);
+            cmng->stats.cache_hits++;
+            cache_mng_lru_hit (cmng, en);
+            cache_mng_update_stats (cmng);
+            on_retrieve_cb (ctx, TRUE, buf, size);
+            hfs_range_destroy (pending);
+            g_free (buf);
+            return;
+        }
     }
 
-    if ((size_t)out_size != size) {
-        LOG_debug (CMNG_LOG, "File doesn't have requested bytes range %s", en->fname);
-        g_free (buf);
-        return NULL;
+    op = g_new0 (CacheMngOp, 1);
+    op->cmng = cmng;
+    op->en = en;
+    op->write = FALSE;
+    op->buf = buf;
+    op->size = size;
+    op->off = off;
+    op->pending = pending;
+    if (pending)
+        op->disk_buf = g_malloc (size);
+    op->on_retrieve_cb = on_retrieve_cb;
+    op->ctx = ctx;
+    en->l_ops = g_list_append (en->l_ops, op);
+
+    cache_io_pread (cmng->cio, en->fd, pending ? op->disk_buf : op->buf, size, off, cache_mng_on_read_cb, op);
+}
+
+// return descriptor of cache file if the whole range can be read from it, or -1
+// ranges which are in memory tier or are not written to disk yet are retrieved with cache_mng_retr_file_data
+int cache_mng_get_file_fd (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off)
+{
+    CacheEntry *en;
+
+    if (!conf_get_boolean (cmng->conf, "filesystem.cache_enabled") || !size)
+        return -1;
+
+    en = g_hash_table_lookup (cmng->h_files, GUINT_TO_POINTER (ino));
+    if (!en || en->fd == -1)
+        return -1;
+
+    if (!hfs_range_contain (en->range, off, off + size) || 
+        cache_mng_mem_contain (cmng, en, size, off) || 
+        cache_mng_has_pending_write (en, size, off))
+        return -1;
+
+    LOG_debug (CMNG_LOG, "Passing descriptor for [%zu %zu] bytes of ino: %"INO_FMT, off, off + size, INO ino);
+    cache_mng_expiry_touch (cmng, en);
+    cmng->stats.cache_hits++;
+    cache_mng_lru_hit (cmng, en);
+    cache_mng_update_stats (cmng);
+
+    return en->fd;
+}
+
+// return descriptor of cache file if it holds exactly the whole object on disk, or -1
+int cache_mng_get_backing_fd (CacheMng *cmng, fuse_ino_t ino, guint64 size)
+{
+    CacheEntry *en;
+    struct stat st;
+
+    if (!conf_get_boolean (cmng->conf, "filesystem.cache_enabled") || !size)
+        return -1;
+
+    en = g_hash_table_lookup (cmng->h_files, GUINT_TO_POINTER (ino));
+    if (!en || en->fd == -1)
+        return -1;
+
+    if (!hfs_range_contain (en->range, 0, size) || cache_mng_has_pending_write (en, size, 0))
+        return -1;
+
+    // kernel reads backing file up to its own size
+    if (fstat (en->fd, &st) == -1 || (guint64)st.st_size != size)
+        return -1;
+
+    LOG_debug (CMNG_LOG, "Passing backing file for ino: %"INO_FMT", size: %"G_GUINT64_FORMAT, INO ino, size);
+    cache_mng_expiry_touch (cmng, en);
+    cmng->stats.cache_hits++;
+    cache_mng_lru_hit (cmng, en);
+    cache_mng_update_stats (cmng);
+
+    return en->fd;
+}
+
+// return TRUE if requested range is cached
+gboolean cache_mng_contain_file_data (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off)
+{
+    CacheEntry *en;
+
+    if (!conf_get_boolean (cmng->conf, "filesystem.cache_enabled")) {
+        return FALSE;
     }
 
-    LOG_debug (CMNG_LOG, "Retrieved [%zu %zu] bytes for ino: %"INO_FMT, off, off + size, INO ino);
-    cmng->cache_hits++;
-    return buf;
+    en = g_hash_table_lookup (cmng->h_files, GUINT_TO_POINTER (ino));
+    if (!en) {
+        return FALSE;
+    }
+
+    return hfs_range_contain (en->range, off, off + size);
 }
 
+GList *cache_mng_get_file_ranges (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off)
+{
+    CacheEntry *en = NULL;
+    HfsRangeSegment *seg;
+
+    if (conf_get_boolean (cmng->conf, "filesystem.cache_enabled"))
+        en = g_hash_table_lookup (cmng->h_files, GUINT_TO_POINTER (ino));
+
+    if (en)
+        return hfs_range_query (en->range, off, off + size);
+
+    // nothing is cached
+    seg = g_new0 (HfsRangeSegment, 1);
+    seg->start = off;
+    seg->end = off + size;
+    seg->covered = FALSE;
+
+    return g_list_append (NULL, seg);
+}
+
+static void cache_mng_on_write_cb (gpointer ctx, ssize_t res, int err)
+{
+    CacheMngOp *op = (CacheMngOp *) ctx;
+    CacheMng *cmng = op->cmng;
+    CacheEntry *en = op->en;
+
+    if (en) {
+        en->l_ops = g_list_remove (en->l_ops, op);
+
+        // range is already marked as cached, drop the whole entry
+        if (res == -1 || (size_t)res != op->size) {
+            LOG_err (CMNG_LOG, "Failed to write to file %s : %s", en->fname, res == -1 ? strerror (err) : "short write");
+            cache_mng_remove_entry (cmng, en);
+            cache_mng_update_stats (cmng);
+        } else {
+            // data is on disk, range can be saved to index
+            hfs_range_add (en->persisted, op->off, op->off + op->size);
+            if (en->path)
+                cmng->index_modified = TRUE;
+        }
+    }
+
+    g_free (op->buf);
+    g_free (op);
+}
 
 void cache_mng_store_file_data (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off, unsigned char *buf)
 {
     CacheEntry *en;
-    ssize_t out_size;
+    CacheMngOp *op;
+    guint64 old_size;
     
     if (!conf_get_boolean (cmng->conf, "filesystem.cache_enabled")) {
         return;
     }
 
+    // doesn't fit into cache
+    if (cmng->max_size && size > cmng->max_size) {
+        return;
+    }
+
     en = g_hash_table_lookup (cmng->h_files, GUINT_TO_POINTER (ino));
     if (!en) {
-        en = cache_entry_create (cmng, ino);
-        g_hash_table_insert (cmng->h_files, GUINT_TO_POINTER (ino), en);
+        en = cache_entry_create (cmng, ino, NULL, NULL);
+        if (!en)
+            return;
+        // admit to probationary segment
+        cache_mng_add_entry (cmng, en);
+        cmng->stats.admissions++;
     }
     // update access time
-    en->atime = time (NULL);
+    cache_mng_expiry_touch (cmng, en);
 
-    out_size = pwrite (en->fd, buf, size, off);
-    if (out_size == -1) {
-        LOG_err (CMNG_LOG, "Failed to write to file %s : %s", en->fname, strerror (errno));
-        return;
-    }
+    cache_mng_mem_invalidate (cmng, en, size, off);
+
+    // data is served from write buffer until it's written to disk
+    op = g_new0 (CacheMngOp, 1);
+    op->cmng = cmng;
+    op->en = en;
+    op->write = TRUE;
+    op->buf = g_malloc (size);
+    memcpy (op->buf, buf, size);
+    op->size = size;
+    op->off = off;
+    en->l_ops = g_list_append (en->l_ops, op);
 
     // add to range
     hfs_range_add (en->range, off, off + size);
 
+    // update size
+    old_size = en->size;
+    en->size = hfs_range_length (en->range);
+    cmng->size += en->size - old_size;
+    if (en->is_protected)
+        cmng->protected_size += en->size - old_size;
+
+    cache_io_pwrite (cmng->cio, en->fd, op->buf, size, off, cache_mng_on_write_cb, op);
+
+    cache_mng_lru_evict (cmng);
+    cache_mng_update_stats (cmng);
+
     // LOG_debug (CMNG_LOG, "Stored [%zu %zu] bytes for ino: %"INO_FMT, off, off + size, INO ino);
 }
 
@@ -232,4 +1007,266 @@ void cache_mng_remove_file_data (CacheMng *cmng, fuse_ino_t ino)
     }
 
     g_hash_table_remove (cmng->h_files, GUINT_TO_POINTER (ino));
+    cache_mng_update_stats (cmng);
+}
+
+/*{{{ persistent cache */
+
+// object is opened: attach data cached by previous mounts to inode, 
+// if object's ETag doesn't match - drop cached data
+void cache_mng_open_file (CacheMng *cmng, fuse_ino_t ino, const gchar *path, const gchar *etag)
+{
+    CacheEntry *en;
+
+    if (!conf_get_boolean (cmng->conf, "filesystem.cache_enabled") || !cmng->persistent) {
+        return;
+    }
+
+    // object version is unknown
+    if (!etag)
+        return;
+
+    en = g_hash_table_lookup (cmng->h_files, GUINT_TO_POINTER (ino));
+    if (en) {
+        // entry is valid
+        if (en->path && !strcmp (en->path, path) && en->etag && !strcmp (en->etag, etag))
+            return;
+
+        // object was changed
+        if (en->path) {
+            LOG_debug (CMNG_LOG, "Cached object is outdated: %s", path);
+            cache_mng_remove_entry (cmng, en);
+        // data was cached before object version became known, make entry persistent
+        } else if (!g_hash_table_lookup (cmng->h_paths, path)) {
+            gchar *fname = cache_mng_get_file_name (cmng, ino, path);
+
+            if (g_rename (en->fname, fname) == 0) {
+                g_free (en->fname);
+                en->fname = fname;
+                en->path = g_strdup (path);
+                en->etag = g_strdup (etag);
+                g_hash_table_insert (cmng->h_paths, en->path, en);
+                cmng->index_modified = TRUE;
+            } else {
+                LOG_err (CMNG_LOG, "Failed to rename file %s: %s", en->fname, strerror (errno));
+                g_free (fname);
+            }
+            return;
+        } else {
+            cache_mng_remove_entry (cmng, en);
+        }
+    }
+
+    en = g_hash_table_lookup (cmng->h_paths, path);
+    if (en) {
+        // revalidate
+        if (!en->etag || strcmp (en->etag, etag)) {
+            LOG_debug (CMNG_LOG, "Cached object is outdated: %s", path);
+            cache_mng_remove_entry (cmng, en);
+            en = NULL;
+        // object got a new inode
+        } else {
+            cache_mng_mem_drop (cmng, en);
+            if (en->ino)
+                g_hash_table_steal (cmng->h_files, GUINT_TO_POINTER (en->ino));
+            else
+                g_hash_table_steal (cmng->h_records, en->path);
+
+            if (!cache_entry_open (en)) {
+                cache_entry_destroy (en);
+                return;
+            }
+            LOG_debug (CMNG_LOG, "Reusing cached object: %s, ino: %"INO_FMT, path, INO ino);
+            en->ino = ino;
+            cache_mng_expiry_touch (cmng, en);
+            g_hash_table_insert (cmng->h_files, GUINT_TO_POINTER (ino), en);
+            return;
+        }
+    }
+
+    // new persistent entry
+    en = cache_entry_create (cmng, ino, path, etag);
+    if (!en)
+        return;
+    cache_mng_add_entry (cmng, en);
+    cmng->stats.admissions++;
+}
+
+// save list of persistent entries to index file
+static void cache_mng_save_index (CacheMng *cmng)
+{
+    GKeyFile *key_file;
+    GHashTableIter iter;
+    gpointer value;
+    gchar *data;
+    gsize len;
+    gchar *index_path;
+    GError *error = NULL;
+
+    key_file = g_key_file_new ();
+
+    g_hash_table_iter_init (&iter, cmng->h_paths);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        CacheEntry *en = (CacheEntry *) value;
+        GList *l_segments, *l;
+        GString *ranges;
+        gchar *group;
+
+        if (!en->size)
+            continue;
+
+        // ranges which are being written are not saved, file could be cut off after crash
+        ranges = g_string_new (NULL);
+        l_segments = hfs_range_query (en->persisted, 0, G_MAXUINT64);
+        for (l = g_list_first (l_segments); l; l = g_list_next (l)) {
+            HfsRangeSegment *seg = (HfsRangeSegment *) l->data;
+            if (seg->covered)
+                g_string_append_printf (ranges, "%s%"G_GUINT64_FORMAT"-%"G_GUINT64_FORMAT, 
+                    ranges->len ? "," : "", seg->start, seg->end);
+        }
+        g_list_free_full (l_segments, g_free);
+
+        if (!ranges->len) {
+            g_string_free (ranges, TRUE);
+            continue;
+        }
+
+        group = g_path_get_basename (en->fname);
+        g_key_file_set_string (key_file, group, "path", en->path);
+        g_key_file_set_string (key_file, group, "etag", en->etag);
+        g_key_file_set_string (key_file, group, "ranges", ranges->str);
+        g_free (group);
+        g_string_free (ranges, TRUE);
+    }
+
+    data = g_key_file_to_data (key_file, &len, NULL);
+    index_path = g_build_filename (conf_get_string (cmng->conf, "filesystem.cache_dir"), CMNG_INDEX_FILE, NULL);
+    if (!g_file_set_contents (index_path, data, len, &error)) {
+        LOG_err (CMNG_LOG, "Failed to save cache index %s: %s", index_path, error->message);
+        g_error_free (error);
+    } else {
+        cmng->index_modified = FALSE;
+    }
+
+    g_free (index_path);
+    g_free (data);
+    g_key_file_free (key_file);
+}
+
+// load persistent entries from index file, remove files which are not in the index
+static void cache_mng_load_index (CacheMng *cmng)
+{
+    GKeyFile *key_file;
+    gchar *index_path;
+    gchar **groups;
+    gsize i, len = 0;
+    GDir *dir;
+    const gchar *name;
+
+    key_file = g_key_file_new ();
+    index_path = g_build_filename (conf_get_string (cmng->conf, "filesystem.cache_dir"), CMNG_INDEX_FILE, NULL);
+    if (!g_key_file_load_from_file (key_file, index_path, G_KEY_FILE_NONE, NULL)) {
+        LOG_debug (CMNG_LOG, "Cache index is not found: %s", index_path);
+    }
+    g_free (index_path);
+
+    groups = g_key_file_get_groups (key_file, &len);
+    for (i = 0; i < len; i++) {
+        gchar *path, *etag, *ranges;
+        CacheEntry *en;
+        gchar **a_ranges;
+        gint j;
+
+        path = g_key_file_get_string (key_file, groups[i], "path", NULL);
+        etag = g_key_file_get_string (key_file, groups[i], "etag", NULL);
+        ranges = g_key_file_get_string (key_file, groups[i], "ranges", NULL);
+
+        if (path && etag && ranges && !g_hash_table_lookup (cmng->h_paths, path)) {
+            struct stat st;
+            gboolean exists;
+
+            en = cache_entry_create (cmng, 0, path, etag);
+            exists = stat (en->fname, &st) == 0 && S_ISREG (st.st_mode);
+            a_ranges = g_strsplit (ranges, ",", -1);
+            for (j = 0; exists && a_ranges[j]; j++) {
+                guint64 start, end;
+                if (sscanf (a_ranges[j], "%"G_GUINT64_FORMAT"-%"G_GUINT64_FORMAT, &start, &end) != 2)
+                    continue;
+                // file could be cut off after crash
+                end = MIN (end, (guint64) st.st_size);
+                if (start < end) {
+                    hfs_range_add (en->range, start, end);
+                    hfs_range_add (en->persisted, start, end);
+                }
+            }
+            g_strfreev (a_ranges);
+            en->size = hfs_range_length (en->range);
+
+            if (exists && en->size) {
+                cache_mng_add_entry (cmng, en);
+            } else {
+                en->size = 0;
+                cache_entry_destroy (en);
+            }
+        }
+
+        g_free (path);
+        g_free (etag);
+        g_free (ranges);
+    }
+    g_strfreev (groups);
+    g_key_file_free (key_file);
+
+    LOG_debug (CMNG_LOG, "Loaded %u cached objects from index", g_hash_table_size (cmng->h_records));
+
+    // remove cache files which are not in the index
+    // only files named as cache files (MD5 of object path) are removed, cache directory can be shared
+    dir = g_dir_open (conf_get_string (cmng->conf, "filesystem.cache_dir"), 0, NULL);
+    if (dir) {
+        GHashTable *h_fnames;
+        GHashTableIter iter;
+        gpointer value;
+
+        // fname -> CacheEntry
+        h_fnames = g_hash_table_new (g_str_hash, g_str_equal);
+        g_hash_table_iter_init (&iter, cmng->h_records);
+        while (g_hash_table_iter_next (&iter, NULL, &value))
+            g_hash_table_insert (h_fnames, ((CacheEntry *) value)->fname, value);
+
+        while ((name = g_dir_read_name (dir))) {
+            gchar *fname;
+
+            if (!cache_mng_is_cache_file_name (name))
+                continue;
+
+            // the same as cache_mng_get_file_name ()
+            fname = g_strdup_printf ("%s/%s", conf_get_string (cmng->conf, "filesystem.cache_dir"), name);
+            if (!g_hash_table_lookup (h_fnames, fname)) {
+                LOG_debug (CMNG_LOG, "Removing cache file which is not in the index: %s", fname);
+                unlink (fname);
+            }
+            g_free (fname);
+        }
+        g_hash_table_destroy (h_fnames);
+        g_dir_close (dir);
+    }
+
+    // cache size could be changed
+    cache_mng_lru_evict (cmng);
+    cmng->index_modified = FALSE;
+}
+/*}}}*/
+
+// export current counters to HfsStatsSrv
+static void cache_mng_update_stats (CacheMng *cmng)
+{
+    cmng->stats.size = cmng->size;
+    cmng->stats.max_size = cmng->max_size;
+    cmng->stats.mem_size = cmng->mem_size;
+    cmng->stats.mem_max_size = cmng->mem_max_size;
+    cmng->stats.mem_blocks = g_hash_table_size (cmng->h_mem_blocks);
+    cmng->stats.entries = g_hash_table_size (cmng->h_files) + g_hash_table_size (cmng->h_records);
+
+    if (application_get_stats_srv (cmng->app))
+        hfs_stats_srv_set_cache_stats (application_get_stats_srv (cmng->app), &cmng->stats);
 }
@@ -28,7 +28,7 @@ struct _DirEntry {
     fuse_ino_t parent_ino;
     gchar *basename;
     gchar *fullpath;
-    guint64 age;
+    guint64 age; // generation of the parent's listing which contained this entry
     gboolean removed;
     
     // type of directory entry
@@ -39,13 +39,20 @@ struct _DirEntry {
     off_t size;
     mode_t mode;
     time_t ctime;
+    gchar *etag; // object's ETag, NULL if unknown
+    gboolean page_cache_valid; // TRUE if kernel page cache may keep data of this object version
 
     // for type == DET_dir
     char *dir_cache; // FUSE directory cache
     size_t dir_cache_size; // directory cache size
     time_t dir_cache_created;
+    gboolean dir_cache_plus; // TRUE if cache is in READDIRPLUS format
 
     GHashTable *h_dir_tree; // name -> data
+    // listing generations (mark and sweep): listing marks children it contains with list_age,
+    // children older than listed_age were not found by the last completed listing
+    guint64 list_age; // generation of the last started listing
+    guint64 listed_age; // generation of the last completed listing
 
     gboolean is_segmented; // TRUE if file contains of segments
     gboolean is_updating; // TRUE if getting attributes
@@ -58,9 +65,9 @@ struct _DirTree {
     ConfData *conf;
 
     fuse_ino_t max_ino;
-    guint64 current_age;
 
     gint64 current_write_ops; // the number of current write operations
+    gboolean passthrough; // TRUE if kernel supports FUSE passthrough
 };
 
 #define DIR_TREE_LOG "dir_tree"
@@ -87,8 +94,8 @@ DirTree *dir_tree_create (Application *app)
     // children entries are destroyed by parent directory entries
     dtree->h_inodes = g_hash_table_new (g_direct_hash, g_direct_equal);
     dtree->max_ino = FUSE_ROOT_ID;
-    dtree->current_age = 0;
     dtree->current_write_ops = 0;
+    dtree->passthrough = FALSE;
 
     dtree->root = dir_tree_add_entry (dtree, "/", DIR_DEFAULT_MODE, DET_dir, 0, 0, time (NULL));
 
@@ -121,6 +128,7 @@ static void dir_entry_destroy (gpointer data)
     en->dir_cache = NULL;
     g_free (en->basename);
     g_free (en->fullpath);
+    g_free (en->etag);
     g_free (en);
 }
 
@@ -171,7 +179,7 @@ static DirEntry *dir_tree_add_entry (DirTree *dtree, const gchar *basename, mode
     en->is_updating = FALSE;
     en->fullpath = fullpath;
     en->ino = dtree->max_ino++;
-    en->age = dtree->current_age;
+    en->age = parent_ino ? parent_en->list_age : 0;
     en->basename = g_strdup (basename);
     en->mode = mode;
     en->size = size;
@@ -202,21 +210,41 @@ static DirEntry *dir_tree_add_entry (DirTree *dtree, const gchar *basename, mode
     return en;
 }
 
-// increase the age of directory
-void dir_tree_start_update (DirTree *dtree, G_GNUC_UNUSED const gchar *dir_path)
+// start a new listing generation of directory, return it
+guint64 dir_tree_start_update (DirTree *dtree, fuse_ino_t ino)
 {
-    //XXX: per directory ?
-    dtree->current_age++;
+    DirEntry *en;
+
+    en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (ino));
+    if (!en || en->type != DET_dir) {
+        LOG_err (DIR_TREE_LOG, "DirEntry is not a directory ! ino: %"INO_FMT, ino);
+        return 0;
+    }
+
+    en->list_age++;
+
+    return en->list_age;
 }
 
-// remove DirEntry, which age is lower than the current
+typedef struct {
+    DirTree *dtree;
+    DirEntry *parent_en;
+} DirTreeSweepData;
+
+// remove DirEntry, which was not found by the last completed listing of the parent
 static gboolean dir_tree_stop_update_on_remove_child_cb (gpointer key, gpointer value, gpointer ctx)
 {
-    DirTree *dtree = (DirTree *)ctx;
+    DirTreeSweepData *sweep_data = (DirTreeSweepData *)ctx;
     DirEntry *en = (DirEntry *) value;
     const gchar *name = (const gchar *) key;
 
-    if (en->age < dtree->current_age && !en->is_modified) {
+    if (en->age < sweep_data->parent_en->listed_age && !en->is_modified) {
+        HfsFuse *hfs_fuse = application_get_hfs_fuse (sweep_data->dtree->app);
+
+        // object was removed remotely, kernel must forget its name
+        if (hfs_fuse)
+            hfs_fuse_notify_inval_entry (hfs_fuse, en->parent_ino, name);
+
         if (en->type == DET_dir) {
             // XXX:
             LOG_debug (DIR_TREE_LOG, "Removing dir: %s", en->fullpath);
@@ -231,28 +259,85 @@ static gboolean dir_tree_stop_update_on_remove_child_cb (gpointer key, gpointer
     return FALSE;
 }
 
-// remove all entries which age is less than current
-void dir_tree_stop_update (DirTree *dtree, fuse_ino_t parent_ino)
+// listing of generation "age" is finished, remove all entries which were not found by it
+// listings of other directories are not affected, failed listing removes nothing
+void dir_tree_stop_update (DirTree *dtree, fuse_ino_t parent_ino, guint64 age, gboolean success)
 {
     DirEntry *parent_en;
+    DirTreeSweepData sweep_data;
 
     parent_en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (parent_ino));
     if (!parent_en || parent_en->type != DET_dir) {
         LOG_err (DIR_TREE_LOG, "DirEntry is not a directory ! ino: %"INO_FMT, parent_ino);
         return;
     }
-    LOG_debug (DIR_TREE_LOG, "Removing old DirEntries for: %s ..", parent_en->fullpath);
 
-    if (parent_en->type != DET_dir) {
-        LOG_err (DIR_TREE_LOG, "Parent is not a directory !");
+    if (!success) {
+        LOG_debug (DIR_TREE_LOG, "Listing of %s failed, keeping old DirEntries", parent_en->fullpath);
         return;
     }
-    
-    g_hash_table_foreach_remove (parent_en->h_dir_tree, dir_tree_stop_update_on_remove_child_cb, dtree);
+
+    // an older listing can finish after a newer one
+    if (age > parent_en->listed_age)
+        parent_en->listed_age = age;
+
+    LOG_debug (DIR_TREE_LOG, "Removing old DirEntries for: %s ..", parent_en->fullpath);
+
+    sweep_data.dtree = dtree;
+    sweep_data.parent_en = parent_en;
+    g_hash_table_foreach_remove (parent_en->h_dir_tree, dir_tree_stop_update_on_remove_child_cb, &sweep_data);
+}
+
+static gint dir_tree_compare_names (gconstpointer a, gconstpointer b)
+{
+    return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+// return "parts - 1" names (NULL-terminated), which split directory into "parts" ranges of the same size
+// names are taken from the previous listing of directory
+// return NULL if directory contains less than "min_entries" entries
+gchar **dir_tree_get_listing_boundaries (DirTree *dtree, fuse_ino_t ino, guint parts, guint min_entries)
+{
+    DirEntry *en;
+    GPtrArray *names;
+    GHashTableIter iter;
+    gpointer value;
+    gchar **boundaries;
+    guint i;
+
+    en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (ino));
+    if (!en || en->type != DET_dir || parts < 2 || g_hash_table_size (en->h_dir_tree) < min_entries)
+        return NULL;
+
+    names = g_ptr_array_sized_new (g_hash_table_size (en->h_dir_tree));
+    g_hash_table_iter_init (&iter, en->h_dir_tree);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        DirEntry *tmp_en = (DirEntry *) value;
+
+        // new entries are not uploaded yet
+        if (!tmp_en->is_modified)
+            g_ptr_array_add (names, tmp_en->basename);
+    }
+
+    if (names->len < min_entries || names->len < parts) {
+        g_ptr_array_free (names, TRUE);
+        return NULL;
+    }
+
+    // server sorts names by bytes
+    g_ptr_array_sort (names, dir_tree_compare_names);
+
+    boundaries = g_new0 (gchar *, parts);
+    for (i = 1; i < parts; i++)
+        boundaries[i - 1] = g_strdup (g_ptr_array_index (names, (guint64) i * names->len / parts));
+
+    g_ptr_array_free (names, TRUE);
+
+    return boundaries;
 }
 
 DirEntry *dir_tree_update_entry (DirTree *dtree, G_GNUC_UNUSED const gchar *path, DirEntryType type, 
-    fuse_ino_t parent_ino, const gchar *entry_name, long long size, time_t last_modified)
+    fuse_ino_t parent_ino, const gchar *entry_name, long long size, time_t last_modified, const gchar *etag)
 {
     DirEntry *parent_en;
     DirEntry *en;
@@ -269,8 +354,34 @@ DirEntry *dir_tree_update_entry (DirTree *dtree, G_GNUC_UNUSED const gchar *path
     // get child
     en = g_hash_table_lookup (parent_en->h_dir_tree, entry_name);
     if (en) {
-        en->age = dtree->current_age;
+        gboolean changed;
+
+        en->age = parent_en->list_age;
+        // object was changed, cached data is not valid anymore
+        // (size is not compared: listing shows zero size for segmented objects)
+        // listing shows manifest's time for segmented object, its version is known only from HEAD ETag
+        if (etag && en->etag)
+            changed = strcmp (etag, en->etag) != 0;
+        else if (en->is_segmented)
+            changed = FALSE;
+        else
+            changed = en->ctime != last_modified;
+        if (en->type == DET_file && changed) {
+            HfsFuse *hfs_fuse = application_get_hfs_fuse (dtree->app);
+
+            LOG_debug (DIR_TREE_LOG, "Object changed, dropping cached data: %s", entry_name);
+            cache_mng_remove_file_data (application_get_cache_mng (dtree->app), en->ino);
+            // pages of the previous version must not be served by kernel
+            en->page_cache_valid = FALSE;
+            if (hfs_fuse)
+                hfs_fuse_notify_inval_inode (hfs_fuse, en->ino);
+        }
         en->size = size;
+        en->ctime = last_modified;
+        if (etag) {
+            g_free (en->etag);
+            en->etag = g_strdup (etag);
+        }
         if (en->type != type) {
             LOG_debug (DIR_TREE_LOG, "Enabling segmentation for: %s", entry_name);
             en->is_segmented = TRUE;
@@ -286,6 +397,8 @@ DirEntry *dir_tree_update_entry (DirTree *dtree, G_GNUC_UNUSED const gchar *path
             
         en = dir_tree_add_entry (dtree, entry_name, mode,
             type, parent_ino, size, last_modified);
+        if (en && etag)
+            en->etag = g_strdup (etag);
     }
 
     return en;
@@ -330,6 +443,7 @@ typedef struct {
     fuse_ino_t ino;
     size_t size;
     off_t off;
+    gboolean plus; // READDIRPLUS request
     dir_tree_readdir_cb readdir_cb;
     fuse_req_t req;
     DirEntry *en;
@@ -352,8 +466,10 @@ void dir_tree_fill_on_dir_buf_cb (gpointer callback_data, gboolean success)
         // construct directory buffer
         // add "." and ".."
         memset (&b, 0, sizeof(b));
-        hfs_fuse_add_dirbuf (dir_fill_data->req, &b, ".", dir_fill_data->en->ino, 0);
-        hfs_fuse_add_dirbuf (dir_fill_data->req, &b, "..", dir_fill_data->en->ino, 0);
+        hfs_fuse_add_dirbuf (dir_fill_data->req, &b, dir_fill_data->plus, ".", 
+            dir_fill_data->en->ino, dir_fill_data->en->mode, 0, dir_fill_data->en->ctime, TRUE);
+        hfs_fuse_add_dirbuf (dir_fill_data->req, &b, dir_fill_data->plus, "..", 
+            dir_fill_data->en->ino, dir_fill_data->en->mode, 0, dir_fill_data->en->ctime, TRUE);
 
         LOG_debug (DIR_TREE_LOG, "Entries in directory : %u", g_hash_table_size (dir_fill_data->en->h_dir_tree));
         
@@ -362,8 +478,11 @@ void dir_tree_fill_on_dir_buf_cb (gpointer callback_data, gboolean success)
         while (g_hash_table_iter_next (&iter, NULL, &value)) {
             DirEntry *tmp_en = (DirEntry *) value;
             // add only updated entries
-            if (tmp_en->age >= dir_fill_data->dtree->current_age)
-                hfs_fuse_add_dirbuf (dir_fill_data->req, &b, tmp_en->basename, tmp_en->ino, tmp_en->size);
+            // size of segmented or modified file is known only after lookup sends HEAD request
+            if (tmp_en->age >= dir_fill_data->en->listed_age)
+                hfs_fuse_add_dirbuf (dir_fill_data->req, &b, dir_fill_data->plus, tmp_en->basename, 
+                    tmp_en->ino, tmp_en->mode, tmp_en->size, tmp_en->ctime, 
+                    !tmp_en->is_segmented && !tmp_en->is_modified);
         }
 
         if (dir_fill_data->en->dir_cache)
@@ -374,6 +493,7 @@ void dir_tree_fill_on_dir_buf_cb (gpointer callback_data, gboolean success)
         dir_fill_data->en->dir_cache_size = b.size;
         dir_fill_data->en->dir_cache = g_malloc (b.size);
         dir_fill_data->en->dir_cache_created = time (NULL);
+        dir_fill_data->en->dir_cache_plus = dir_fill_data->plus;
 
 
         memcpy (dir_fill_data->en->dir_cache, b.p, b.size);
@@ -402,7 +522,7 @@ static void dir_tree_fill_dir_on_http_ready (gpointer client, gpointer ctx)
 // return directory buffer from the cache
 // or regenerate directory cache
 void dir_tree_fill_dir_buf (DirTree *dtree, 
-        fuse_ino_t ino, size_t size, off_t off,
+        fuse_ino_t ino, size_t size, off_t off, gboolean plus,
         dir_tree_readdir_cb readdir_cb, fuse_req_t req)
 {
     DirEntry *en;
@@ -424,7 +544,7 @@ void dir_tree_fill_dir_buf (DirTree *dtree,
     t = time (NULL);
 
     // already have directory buffer in the cache
-    if (en->dir_cache_size && t >= en->dir_cache_created && t - en->dir_cache_created <= conf_get_uint (dtree->conf, "filesystem.dir_cache_max_time")) {
+    if (en->dir_cache_size && en->dir_cache_plus == plus && t >= en->dir_cache_created && t - en->dir_cache_created <= conf_get_uint (dtree->conf, "filesystem.dir_cache_max_time")) {
         LOG_debug (DIR_TREE_LOG, "Sending directory buffer (ino = %"INO_FMT") from cache !", ino);
         readdir_cb (req, TRUE, size, off, en->dir_cache, en->dir_cache_size);
         return;
@@ -444,6 +564,7 @@ void dir_tree_fill_dir_buf (DirTree *dtree,
     dir_fill_data->ino = ino;
     dir_fill_data->size = size;
     dir_fill_data->off = off;
+    dir_fill_data->plus = plus;
     dir_fill_data->readdir_cb = readdir_cb;
     dir_fill_data->req = req;
     dir_fill_data->en = en;
@@ -478,6 +599,8 @@ static void dir_tree_lookup_on_attr_cb (HttpConnection *con, void *ctx,
     const char *size_header;
     const char *meta_header;
     DirEntry  *en;
+    // object is removed from the storage
+    gboolean not_found = con->response_code == 404;
     
     LOG_debug (DIR_TREE_LOG, "Got attributes for ino: %"INO_FMT, op_data->ino);
 
@@ -489,14 +612,14 @@ static void dir_tree_lookup_on_attr_cb (HttpConnection *con, void *ctx,
     // entry not found
     if (!en) {
         LOG_err (DIR_TREE_LOG, "Entry (%"INO_FMT") not found !", op_data->ino);
-        op_data->lookup_cb (op_data->req, FALSE, 0, 0, 0, 0);
+        op_data->lookup_cb (op_data->req, FALSE, TRUE, 0, 0, 0, 0);
         g_free (op_data);
         return;
     }
 
     if (!success) {
         LOG_err (DIR_TREE_LOG, "Failed to get entry (%"INO_FMT") attributes !", op_data->ino);
-        op_data->lookup_cb (op_data->req, FALSE, 0, 0, 0, 0);
+        op_data->lookup_cb (op_data->req, FALSE, not_found, 0, 0, 0, 0);
         g_free (op_data);
         en->is_updating = FALSE;
         return;
@@ -519,7 +642,7 @@ static void dir_tree_lookup_on_attr_cb (HttpConnection *con, void *ctx,
         en->is_segmented = TRUE;
     }
     
-    op_data->lookup_cb (op_data->req, TRUE, en->ino, en->mode, en->size, en->ctime);
+    op_data->lookup_cb (op_data->req, TRUE, FALSE, en->ino, en->mode, en->size, en->ctime);
     en->is_updating = FALSE;
     g_free (op_data);
 }
@@ -539,7 +662,7 @@ static void dir_tree_lookup_on_con_cb (gpointer client, gpointer ctx)
     // entry not found
     if (!en) {
         LOG_err (DIR_TREE_LOG, "Entry (%"INO_FMT") not found !", op_data->ino);
-        op_data->lookup_cb (op_data->req, FALSE, 0, 0, 0, 0);
+        op_data->lookup_cb (op_data->req, FALSE, TRUE, 0, 0, 0, 0);
         g_free (op_data);
         return;
     }
@@ -561,7 +684,7 @@ static void dir_tree_lookup_on_con_cb (gpointer client, gpointer ctx)
     if (!res) {
         LOG_err (DIR_TREE_LOG, "Failed to create HTTP request !");
         http_connection_release (con);
-        op_data->lookup_cb (op_data->req, FALSE, 0, 0, 0, 0);
+        op_data->lookup_cb (op_data->req, FALSE, FALSE, 0, 0, 0, 0);
         en->is_updating = FALSE;
         g_free (op_data);
         return;
@@ -576,11 +699,15 @@ static void dir_tree_lookup_on_not_found_data_cb (HttpConnection *con, void *ctx
     const char *size_header;
     const char *meta_header;
     const char *last_modified_header;
+    const char *etag_header;
+    gchar *etag = NULL;
     DirEntry *en;
     time_t last_modified = time (NULL);
     DirEntry *parent_en;
     long long size = 0;
     gboolean is_segmented = FALSE;
+    // only a missing object is cached as a negative entry, not a server failure
+    gboolean not_found = con->response_code == 404;
     
     LOG_debug (DIR_TREE_LOG, "Got attributes for ino: %"INO_FMT, op_data->ino);
 
@@ -589,9 +716,9 @@ static void dir_tree_lookup_on_not_found_data_cb (HttpConnection *con, void *ctx
 
     // file not found
     if (!success) {
-        LOG_err (DIR_TREE_LOG, "FileEntry not found %s", op_data->name);
+        LOG_err (DIR_TREE_LOG, "FileEntry not found %s, HTTP code: %d", op_data->name, con->response_code);
 
-        op_data->lookup_cb (op_data->req, FALSE, 0, 0, 0, 0);
+        op_data->lookup_cb (op_data->req, FALSE, not_found, 0, 0, 0, 0);
         g_free (op_data->name);
         g_free (op_data);
         return;
@@ -601,7 +728,7 @@ static void dir_tree_lookup_on_not_found_data_cb (HttpConnection *con, void *ctx
     if (!parent_en) {
         LOG_err (DIR_TREE_LOG, "Parent not found for ino: %"INO_FMT" !", op_data->parent_ino);
 
-        op_data->lookup_cb (op_data->req, FALSE, 0, 0, 0, 0);
+        op_data->lookup_cb (op_data->req, FALSE, TRUE, 0, 0, 0, 0);
         g_free (op_data->name);
         g_free (op_data);
         return;
@@ -620,18 +747,32 @@ static void dir_tree_lookup_on_not_found_data_cb (HttpConnection *con, void *ctx
 
     last_modified_header = evhttp_find_header (headers, "Last-Modified");
     if (last_modified_header) {
-        struct tm tmp;
-        strptime (last_modified_header, "%FT%T", &tmp);
+        struct tm tmp = {0};
+        // HTTP date
+        if (!strptime (last_modified_header, "%a, %d %b %Y %T", &tmp))
+            strptime (last_modified_header, "%FT%T", &tmp);
         last_modified = mktime (&tmp);
     }
 
+    // ETag of segmented object is quoted MD5 of segments' MD5 sums, listing shows unquoted MD5
+    etag_header = evhttp_find_header (headers, "Etag");
+    if (etag_header) {
+        size_t etag_len = strlen (etag_header);
+
+        if (etag_len >= 2 && etag_header[0] == '"' && etag_header[etag_len - 1] == '"')
+            etag = g_strndup (etag_header + 1, etag_len - 2);
+        else
+            etag = g_strdup (etag_header);
+    }
+
     en = dir_tree_update_entry (op_data->dtree, parent_en->fullpath, DET_file, 
-        op_data->parent_ino, op_data->name, size, last_modified);
+        op_data->parent_ino, op_data->name, size, last_modified, etag);
+    g_free (etag);
 
     if (!en) {
         LOG_err (DIR_TREE_LOG, "Failed to create FileEntry parent ino: %"INO_FMT" !", op_data->parent_ino);
 
-        op_data->lookup_cb (op_data->req, FALSE, 0, 0, 0, 0);
+        op_data->lookup_cb (op_data->req, FALSE, FALSE, 0, 0, 0, 0);
         g_free (op_data->name);
         g_free (op_data);
         return;
@@ -639,7 +780,7 @@ static void dir_tree_lookup_on_not_found_data_cb (HttpConnection *con, void *ctx
 
     en->is_segmented = is_segmented;
 
-    op_data->lookup_cb (op_data->req, TRUE, en->ino, en->mode, en->size, en->ctime);
+    op_data->lookup_cb (op_data->req, TRUE, FALSE, en->ino, en->mode, en->size, en->ctime);
     g_free (op_data->name);
     g_free (op_data);
 }
@@ -658,7 +799,7 @@ static void dir_tree_lookup_on_not_found_con_cb (gpointer client, gpointer ctx)
     if (!parent_en) {
         LOG_err (DIR_TREE_LOG, "Parent not found for ino: %"INO_FMT" !", op_data->parent_ino);
 
-        op_data->lookup_cb (op_data->req, FALSE, 0, 0, 0, 0);
+        op_data->lookup_cb (op_data->req, FALSE, TRUE, 0, 0, 0, 0);
         g_free (op_data->name);
         g_free (op_data);
         return;
@@ -688,7 +829,7 @@ static void dir_tree_lookup_on_not_found_con_cb (gpointer client, gpointer ctx)
     if (!res) {
         LOG_err (DIR_TREE_LOG, "Failed to create HTTP request !");
         http_connection_release (con);
-        op_data->lookup_cb (op_data->req, FALSE, 0, 0, 0, 0);
+        op_data->lookup_cb (op_data->req, FALSE, FALSE, 0, 0, 0, 0);
         g_free (op_data->name);
         g_free (op_data);
         return;
@@ -708,7 +849,7 @@ void dir_tree_lookup (DirTree *dtree, fuse_ino_t parent_ino, const char *name,
     // entry not found
     if (!dir_en || dir_en->type != DET_dir) {
         LOG_msg (DIR_TREE_LOG, "Directory (%d) not found !", parent_ino);
-        lookup_cb (req, FALSE, 0, 0, 0, 0);
+        lookup_cb (req, FALSE, TRUE, 0, 0, 0, 0);
         return;
     }
 
@@ -730,7 +871,7 @@ void dir_tree_lookup (DirTree *dtree, fuse_ino_t parent_ino, const char *name,
 
         if (!client_pool_get_client (application_get_ops_client_pool (dtree->app), dir_tree_lookup_on_not_found_con_cb, op_data)) {
             LOG_err (DIR_TREE_LOG, "Failed to get HTTP client !");
-            lookup_cb (req, FALSE, 0, 0, 0, 0);
+            lookup_cb (req, FALSE, FALSE, 0, 0, 0, 0);
             g_free (op_data->name);
             g_free (op_data);
         }
@@ -740,7 +881,7 @@ void dir_tree_lookup (DirTree *dtree, fuse_ino_t parent_ino, const char *name,
     // file is removed
     if (en->removed) {
         LOG_debug (DIR_TREE_LOG, "Entry '%s' is removed !", name);
-        lookup_cb (req, FALSE, 0, 0, 0, 0);
+        lookup_cb (req, FALSE, TRUE, 0, 0, 0, 0);
         return;
     }
 
@@ -765,7 +906,7 @@ void dir_tree_lookup (DirTree *dtree, fuse_ino_t parent_ino, const char *name,
 
         if (!client_pool_get_client (application_get_ops_client_pool (dtree->app), dir_tree_lookup_on_con_cb, op_data)) {
             LOG_err (DIR_TREE_LOG, "Failed to get HTTP client !");
-            lookup_cb (req, FALSE, 0, 0, 0, 0);
+            lookup_cb (req, FALSE, FALSE, 0, 0, 0, 0);
             en->is_updating = FALSE;
             g_free (op_data);
         }
@@ -794,7 +935,7 @@ void dir_tree_lookup (DirTree *dtree, fuse_ino_t parent_ino, const char *name,
         
         if (!client_pool_get_client (application_get_ops_client_pool (dtree->app), dir_tree_lookup_on_con_cb, op_data)) {
             LOG_err (DIR_TREE_LOG, "Failed to get HTTP client !");
-            lookup_cb (req, FALSE, 0, 0, 0, 0);
+            lookup_cb (req, FALSE, FALSE, 0, 0, 0, 0);
             en->is_updating = FALSE;
             g_free (op_data);
         }
@@ -803,7 +944,7 @@ void dir_tree_lookup (DirTree *dtree, fuse_ino_t parent_ino, const char *name,
         return;
     }
 
-    lookup_cb (req, TRUE, en->ino, en->mode, en->size, en->ctime);
+    lookup_cb (req, TRUE, FALSE, en->ino, en->mode, en->size, en->ctime);
 }
 /*}}}*/
 
@@ -1018,6 +1159,11 @@ void dir_tree_file_create (DirTree *dtree, fuse_ino_t parent_ino, const char *na
 }
 /*}}}*/
 
+void dir_tree_set_passthrough (DirTree *dtree, gboolean enabled)
+{
+    dtree->passthrough = enabled;
+}
+
 /*{{{ dir_tree_file_open */
 // existing file is opened, create context data
 void dir_tree_file_open (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *fi, 
@@ -1036,9 +1182,42 @@ void dir_tree_file_open (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *
         return;
     }
 
+    // lets CacheMng reuse data cached for this object by previous mounts
+    cache_mng_open_file (application_get_cache_mng (dtree->app), ino, en->fullpath, en->etag);
+
     fop = hfs_fileop_create (dtree->app, en->fullpath);
+    hfs_fileop_set_object_size (fop, en->size);
     fi->fh = (uint64_t) fop;
 
+    // ETag / Last-Modified did not change since the previous open: kernel keeps cached pages
+    // (changes found by listing or lookup invalidate them, see dir_tree_update_entry)
+    if ((fi->flags & O_ACCMODE) == O_RDONLY && !en->is_modified) {
+        fi->keep_cache = en->page_cache_valid;
+        en->page_cache_valid = TRUE;
+    } else {
+        en->page_cache_valid = FALSE;
+    }
+
+#ifdef FUSE_CAP_PASSTHROUGH
+    // object is completely cached: kernel reads cache file directly, without sending READ requests
+    // files opened for writing and modified objects are served as usual
+    if (dtree->passthrough && (fi->flags & O_ACCMODE) == O_RDONLY && !en->is_modified) {
+        int fd = cache_mng_get_backing_fd (application_get_cache_mng (dtree->app), ino, en->size);
+
+        if (fd != -1) {
+            int backing_id = fuse_passthrough_open (req, fd);
+
+            if (backing_id > 0) {
+                LOG_debug (DIR_TREE_LOG, "[fop: %p] passthrough inode %"INO_FMT", backing id: %d", fop, ino, backing_id);
+                fi->backing_id = backing_id;
+                hfs_fileop_set_backing_id (fop, backing_id);
+            } else {
+                LOG_debug (DIR_TREE_LOG, "Failed to open backing file for inode %"INO_FMT, ino);
+            }
+        }
+    }
+#endif
+
     LOG_debug (DIR_TREE_LOG, "[fop: %p] dir_tree_open inode %"INO_FMT, fop, ino);
 
     file_open_cb (req, TRUE, fi);
@@ -1047,7 +1226,7 @@ void dir_tree_file_open (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *
 
 /*{{{ dir_tree_file_release*/
 // file is closed, free context data
-void dir_tree_file_release (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *fi)
+void dir_tree_file_release (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *fi, fuse_req_t req)
 {
     DirEntry *en;
     HfsFileOp *fop;
@@ -1066,6 +1245,11 @@ void dir_tree_file_release (DirTree *dtree, fuse_ino_t ino, struct fuse_file_inf
 
     LOG_debug (DIR_TREE_LOG, "[fop: %p] dir_tree_file_release inode: %"INO_FMT, fop, ino);
 
+#ifdef FUSE_CAP_PASSTHROUGH
+    if (hfs_fileop_get_backing_id (fop) > 0)
+        fuse_passthrough_close (req, hfs_fileop_get_backing_id (fop));
+#endif
+
     hfs_fileop_release (fop);
 }
 /*}}}*/
@@ -1077,7 +1261,7 @@ typedef struct {
     fuse_req_t req;
 } FileReadOpData;
 
-static void dir_tree_on_buffer_read_cb (gpointer ctx, gboolean success, char *buf, size_t size)
+static void dir_tree_on_buffer_read_cb (gpointer ctx, gboolean success, struct fuse_bufvec *bufv)
 {
     FileReadOpData *op_data = (FileReadOpData *)ctx;
 
@@ -1085,12 +1269,12 @@ static void dir_tree_on_buffer_read_cb (gpointer ctx, gboolean success, char *bu
 
     if (!success) {
         LOG_err (DIR_TREE_LOG, "Failed to read file !");
-        op_data->file_read_cb (op_data->req, FALSE, NULL, 0);
+        op_data->file_read_cb (op_data->req, FALSE, NULL);
         g_free (op_data);
         return;
     }
     
-    op_data->file_read_cb (op_data->req, TRUE, buf, size);
+    op_data->file_read_cb (op_data->req, TRUE, bufv);
     g_free (op_data);
 }
 
@@ -1110,7 +1294,7 @@ void dir_tree_file_read (DirTree *dtree, fuse_ino_t ino,
     // or it's not a directory type ?
     if (!en) {
         LOG_err (DIR_TREE_LOG, "Entry (ino = %"INO_FMT") not found !", ino);
-        file_read_cb (req, FALSE, NULL, 0);
+        file_read_cb (req, FALSE, NULL);
         return;
     }
     
@@ -1122,7 +1306,7 @@ void dir_tree_file_read (DirTree *dtree, fuse_ino_t ino,
     op_data->file_read_cb = file_read_cb;
     op_data->req = req;
 
-    hfs_fileop_read_buffer (fop, size, off, ino, dir_tree_on_buffer_read_cb, op_data);
+    hfs_fileop_read_buffer (fop, size, off, ino, req, dir_tree_on_buffer_read_cb, op_data);
 
 }
 /*}}}*/
@@ -1148,7 +1332,7 @@ static void dir_tree_on_buffer_written_cb (G_GNUC_UNUSED HfsFileOp *fop, gpointe
 
 // send data via HTTP client
 void dir_tree_file_write (DirTree *dtree, fuse_ino_t ino, 
-    const char *buf, size_t size, off_t off, 
+    struct fuse_bufvec *bufv, off_t off, 
     DirTree_file_write_cb file_write_cb, fuse_req_t req,
     struct fuse_file_info *fi)
 {
@@ -1173,9 +1357,9 @@ void dir_tree_file_write (DirTree *dtree, fuse_ino_t ino,
     op_data->file_write_cb = file_write_cb;
     op_data->req = req;
     
-    // LOG_debug (DIR_TREE_LOG, "[fop: %p op: %p] write inode %"INO_FMT", size: %zd, off: %"OFF_FMT, fop, op_data, ino, size, off);
+    // LOG_debug (DIR_TREE_LOG, "[fop: %p op: %p] write inode %"INO_FMT", size: %zd, off: %"OFF_FMT, fop, op_data, ino, fuse_buf_size (bufv), off);
 
-    hfs_fileop_write_buffer (fop, buf, size, off, ino, dir_tree_on_buffer_written_cb, op_data);
+    hfs_fileop_write_buffer (fop, bufv, off, ino, dir_tree_on_buffer_written_cb, op_data);
 }
 /*}}}*/
 
@@ -1515,7 +1699,7 @@ void dir_tree_dir_create (DirTree *dtree, fuse_ino_t parent_ino, const char *nam
     //XXX: set as new 
     en->is_modified = FALSE;
     // do not delete it
-    en->age = G_MAXUINT32;
+    en->age = G_MAXUINT64;
     en->mode = DIR_DEFAULT_MODE;
 
     mkdir_cb (req, TRUE, en->ino, en->mode, en->size, en->ctime);
@@ -0,0 +1,631 @@
+/*  
+ * Copyright 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "hfs_dir_list_parser.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*{{{ struct */
+
+// position in JSON listing
+typedef enum {
+    JS_start = 0, // expecting '['
+    JS_first, // expecting the first entry or ']'
+    JS_entry, // expecting entry
+    JS_next, // expecting ',' or ']'
+    JS_end, // listing is complete
+} JsonState;
+
+// result of parsing JSON value
+typedef enum {
+    JR_error = -1,
+    JR_incomplete = 0, // buffer ends before value
+    JR_ok = 1,
+} JsonResult;
+
+struct _HfsDirListParser {
+    HfsDirListFormat format;
+    HfsDirListParser_on_entry_cb on_entry_cb;
+    gpointer ctx;
+    gboolean failed;
+
+    // XML, parsed by SAX callbacks without building DOM
+    xmlParserCtxtPtr xmlctx;
+    gint depth; // depth of the current XML element, 1 - <container>, 2 - entry, 3 - entry field
+    GString *text; // text of the current entry field
+
+    // JSON
+    JsonState json_state;
+    GString *json_buf; // the beginning of entry which is not received completely
+    GString *json_key;
+
+    // entry being parsed
+    gboolean has_name;
+    GString *name;
+    gboolean is_subdir;
+    guint64 bytes;
+    gboolean has_hash;
+    GString *hash;
+    gboolean has_content_type;
+    GString *content_type;
+    time_t last_modified;
+};
+
+#define DLP_LOG "dir_list"
+/*}}}*/
+
+/*{{{ entry */
+
+static void hfs_dir_list_parser_entry_reset (HfsDirListParser *parser)
+{
+    parser->has_name = FALSE;
+    parser->is_subdir = FALSE;
+    parser->bytes = 0;
+    parser->has_hash = FALSE;
+    parser->has_content_type = FALSE;
+    parser->last_modified = time (NULL);
+}
+
+// pass parsed entry to caller
+static void hfs_dir_list_parser_entry_done (HfsDirListParser *parser)
+{
+    HfsDirListEntry entry;
+
+    if (!parser->has_name)
+        return;
+
+    entry.name = parser->name->str;
+    entry.is_subdir = parser->is_subdir;
+    entry.bytes = parser->bytes;
+    entry.hash = parser->has_hash ? parser->hash->str : NULL;
+    entry.content_type = parser->has_content_type ? parser->content_type->str : NULL;
+    entry.last_modified = parser->last_modified;
+
+    parser->on_entry_cb (parser->ctx, &entry);
+}
+
+static time_t hfs_dir_list_parse_time (const gchar *str)
+{
+    struct tm tmp = {0};
+
+    strptime (str, "%FT%T", &tmp);
+    return mktime (&tmp);
+}
+/*}}}*/
+
+/*{{{ XML */
+
+static void hfs_dir_list_xml_on_start_element (void *ctx, const xmlChar *name, G_GNUC_UNUSED const xmlChar **attrs)
+{
+    HfsDirListParser *parser = (HfsDirListParser *) ctx;
+
+    parser->depth++;
+
+    // document isn't a listing
+    if (parser->depth == 1 && strcasecmp ((const char *)name, "container"))
+        parser->failed = TRUE;
+
+    if (parser->depth == 2) {
+        hfs_dir_list_parser_entry_reset (parser);
+        parser->is_subdir = !strcasecmp ((const char *)name, "subdir");
+    }
+
+    g_string_truncate (parser->text, 0);
+}
+
+// text can be split into several calls
+static void hfs_dir_list_xml_on_characters (void *ctx, const xmlChar *ch, int len)
+{
+    HfsDirListParser *parser = (HfsDirListParser *) ctx;
+
+    if (parser->depth == 3)
+        g_string_append_len (parser->text, (const gchar *) ch, len);
+}
+
+static void hfs_dir_list_xml_on_end_element (void *ctx, const xmlChar *name)
+{
+    HfsDirListParser *parser = (HfsDirListParser *) ctx;
+    const char *element = (const char *) name;
+
+    if (parser->depth == 3) {
+        if (!strcasecmp (element, "name")) {
+            g_string_assign (parser->name, parser->text->str);
+            parser->has_name = TRUE;
+        } else if (!strcasecmp (element, "bytes")) {
+            parser->bytes = g_ascii_strtoull (parser->text->str, NULL, 10);
+        } else if (!strcasecmp (element, "hash")) {
+            g_string_assign (parser->hash, parser->text->str);
+            parser->has_hash = TRUE;
+        } else if (!strcasecmp (element, "content_type")) {
+            g_string_assign (parser->content_type, parser->text->str);
+            parser->has_content_type = TRUE;
+        } else if (!strcasecmp (element, "last_modified")) {
+            parser->last_modified = hfs_dir_list_parse_time (parser->text->str);
+        }
+    } else if (parser->depth == 2) {
+        if (!strcasecmp (element, "object") || !strcasecmp (element, "subdir"))
+            hfs_dir_list_parser_entry_done (parser);
+        else
+            LOG_debug (DLP_LOG, "unknown element: %s", element);
+    }
+
+    parser->depth--;
+}
+
+static xmlSAXHandler hfs_dir_list_xml_handler = {
+    .startElement = hfs_dir_list_xml_on_start_element,
+    .endElement = hfs_dir_list_xml_on_end_element,
+    .characters = hfs_dir_list_xml_on_characters,
+};
+/*}}}*/
+
+/*{{{ JSON */
+
+// return pointer to the first '"' or '\' character, or "end"
+// names and hashes make most of listing, they are scanned 16 bytes at a time
+static const gchar *hfs_dir_list_json_scan_string (const gchar *p, const gchar *end)
+{
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8 ('"');
+    const __m128i escape = _mm_set1_epi8 ('\\');
+
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128 ((const __m128i *) p);
+        int mask = _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (chunk, quote), _mm_cmpeq_epi8 (chunk, escape)));
+
+        if (mask)
+            return p + __builtin_ctz (mask);
+        p += 16;
+    }
+#endif
+
+    while (p < end && *p != '"' && *p != '\\')
+        p++;
+
+    return p;
+}
+
+static const gchar *hfs_dir_list_json_skip_ws (const gchar *p, const gchar *end)
+{
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+        p++;
+
+    return p;
+}
+
+static gint hfs_dir_list_json_hex (const gchar *p)
+{
+    gint i;
+    gint res = 0;
+
+    for (i = 0; i < 4; i++) {
+        if (!g_ascii_isxdigit (p[i]))
+            return -1;
+        res = (res << 4) | g_ascii_xdigit_value (p[i]);
+    }
+
+    return res;
+}
+
+// decode string, "*p" points after the opening quote, on success it points after the closing quote
+static JsonResult hfs_dir_list_json_string (const gchar **p, const gchar *end, GString *out)
+{
+    const gchar *s = *p;
+
+    g_string_truncate (out, 0);
+
+    for (;;) {
+        const gchar *q = hfs_dir_list_json_scan_string (s, end);
+        gint c;
+
+        g_string_append_len (out, s, q - s);
+        if (q == end)
+            return JR_incomplete;
+
+        if (*q == '"') {
+            *p = q + 1;
+            return JR_ok;
+        }
+
+        // escape sequence
+        if (end - q < 2)
+            return JR_incomplete;
+
+        switch (q[1]) {
+            case '"': case '\\': case '/':
+                g_string_append_c (out, q[1]);
+                s = q + 2;
+                break;
+            case 'b': g_string_append_c (out, '\b'); s = q + 2; break;
+            case 'f': g_string_append_c (out, '\f'); s = q + 2; break;
+            case 'n': g_string_append_c (out, '\n'); s = q + 2; break;
+            case 'r': g_string_append_c (out, '\r'); s = q + 2; break;
+            case 't': g_string_append_c (out, '\t'); s = q + 2; break;
+            case 'u':
+                if (end - q < 6)
+                    return JR_incomplete;
+                c = hfs_dir_list_json_hex (q + 2);
+                if (c < 0)
+                    return JR_error;
+                s = q + 6;
+
+                // surrogate pair
+                if (c >= 0xD800 && c <= 0xDBFF) {
+                    gint low;
+
+                    if (end - s < 6)
+                        return JR_incomplete;
+                    if (s[0] != '\\' || s[1] != 'u' || (low = hfs_dir_list_json_hex (s + 2)) < 0xDC00 || low > 0xDFFF)
+                        return JR_error;
+                    c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                    s += 6;
+                }
+                g_string_append_unichar (out, c);
+                break;
+            default:
+                return JR_error;
+        }
+    }
+}
+
+// skip number or literal (true, false, null), store it to "out"
+static JsonResult hfs_dir_list_json_scalar (const gchar **p, const gchar *end, GString *out)
+{
+    const gchar *s = *p;
+
+    while (s < end && (g_ascii_isalnum (*s) || *s == '-' || *s == '+' || *s == '.'))
+        s++;
+
+    if (s == end)
+        return JR_incomplete;
+    if (s == *p)
+        return JR_error;
+
+    g_string_truncate (out, 0);
+    g_string_append_len (out, *p, s - *p);
+    *p = s;
+
+    return JR_ok;
+}
+
+// skip nested object or array, Swift doesn't return them in listing entries
+static JsonResult hfs_dir_list_json_skip_nested (const gchar **p, const gchar *end)
+{
+    const gchar *s = *p;
+    gint depth = 0;
+
+    while (s < end) {
+        if (*s == '"') {
+            s = hfs_dir_list_json_scan_string (s + 1, end);
+            // skip escaped character
+            while (s < end && *s == '\\') {
+                if (end - s < 2)
+                    return JR_incomplete;
+                s = hfs_dir_list_json_scan_string (s + 2, end);
+            }
+            if (s == end)
+                return JR_incomplete;
+        } else if (*s == '{' || *s == '[') {
+            depth++;
+        } else if (*s == '}' || *s == ']') {
+            depth--;
+            if (!depth) {
+                *p = s + 1;
+                return JR_ok;
+            }
+        }
+        s++;
+    }
+
+    return JR_incomplete;
+}
+
+// parse object value of the key which is in parser->json_key
+static JsonResult hfs_dir_list_json_value (HfsDirListParser *parser, const gchar **p, const gchar *end)
+{
+    const gchar *key = parser->json_key->str;
+    JsonResult res;
+
+    if (**p == '{' || **p == '[')
+        return hfs_dir_list_json_skip_nested (p, end);
+
+    if (**p != '"') {
+        res = hfs_dir_list_json_scalar (p, end, parser->text);
+        if (res == JR_ok && !strcmp (key, "bytes"))
+            parser->bytes = g_ascii_strtoull (parser->text->str, NULL, 10);
+        return res;
+    }
+
+    (*p)++;
+    if (!strcmp (key, "name")) {
+        res = hfs_dir_list_json_string (p, end, parser->name);
+        parser->has_name = TRUE;
+    } else if (!strcmp (key, "subdir")) {
+        res = hfs_dir_list_json_string (p, end, parser->name);
+        parser->has_name = TRUE;
+        parser->is_subdir = TRUE;
+    } else if (!strcmp (key, "hash")) {
+        res = hfs_dir_list_json_string (p, end, parser->hash);
+        parser->has_hash = TRUE;
+    } else if (!strcmp (key, "content_type")) {
+        res = hfs_dir_list_json_string (p, end, parser->content_type);
+        parser->has_content_type = TRUE;
+    } else {
+        res = hfs_dir_list_json_string (p, end, parser->text);
+        if (res == JR_ok && !strcmp (key, "last_modified"))
+            parser->last_modified = hfs_dir_list_parse_time (parser->text->str);
+    }
+
+    return res;
+}
+
+// parse listing entry: {"name": "a", "hash": "..", "bytes": 1, "content_type": "..", "last_modified": ".."}
+// or {"subdir": "a/"}
+static JsonResult hfs_dir_list_json_entry (HfsDirListParser *parser, const gchar **p, const gchar *end)
+{
+    const gchar *s = *p;
+    JsonResult res;
+
+    if (*s != '{')
+        return JR_error;
+    s++;
+
+    hfs_dir_list_parser_entry_reset (parser);
+
+    s = hfs_dir_list_json_skip_ws (s, end);
+    if (s == end)
+        return JR_incomplete;
+    if (*s == '}') {
+        *p = s + 1;
+        return JR_ok;
+    }
+
+    for (;;) {
+        if (*s != '"')
+            return JR_error;
+        s++;
+        res = hfs_dir_list_json_string (&s, end, parser->json_key);
+        if (res != JR_ok)
+            return res;
+
+        s = hfs_dir_list_json_skip_ws (s, end);
+        if (s == end)
+            return JR_incomplete;
+        if (*s != ':')
+            return JR_error;
+        s = hfs_dir_list_json_skip_ws (s + 1, end);
+        if (s == end)
+            return JR_incomplete;
+
+        res = hfs_dir_list_json_value (parser, &s, end);
+        if (res != JR_ok)
+            return res;
+
+        s = hfs_dir_list_json_skip_ws (s, end);
+        if (s == end)
+            return JR_incomplete;
+        if (*s == '}')
+            break;
+        if (*s != ',')
+            return JR_error;
+        s = hfs_dir_list_json_skip_ws (s + 1, end);
+        if (s == end)
+            return JR_incomplete;
+    }
+
+    *p = s + 1;
+    return JR_ok;
+}
+
+// parse listing array, return number of consumed bytes
+// an entry which is not received completely is not consumed
+static size_t hfs_dir_list_json_parse (HfsDirListParser *parser, const gchar *buf, size_t buf_len)
+{
+    const gchar *p = buf;
+    const gchar *end = buf + buf_len;
+    const gchar *entry_end;
+    JsonResult res;
+
+    for (;;) {
+        p = hfs_dir_list_json_skip_ws (p, end);
+        if (p == end)
+            break;
+
+        switch (parser->json_state) {
+            case JS_start:
+                if (*p != '[') {
+                    parser->failed = TRUE;
+                    return p - buf;
+                }
+                p++;
+                parser->json_state = JS_first;
+                break;
+
+            case JS_first:
+                if (*p == ']') {
+                    p++;
+                    parser->json_state = JS_end;
+                    break;
+                }
+                parser->json_state = JS_entry;
+                break;
+
+            case JS_entry:
+                entry_end = p;
+                res = hfs_dir_list_json_entry (parser, &entry_end, end);
+                if (res == JR_incomplete)
+                    return p - buf;
+                if (res == JR_error) {
+                    parser->failed = TRUE;
+                    return p - buf;
+                }
+                hfs_dir_list_parser_entry_done (parser);
+                p = entry_end;
+                parser->json_state = JS_next;
+                break;
+
+            case JS_next:
+                if (*p == ',') {
+                    parser->json_state = JS_entry;
+                } else if (*p == ']') {
+                    parser->json_state = JS_end;
+                } else {
+                    parser->failed = TRUE;
+                    return p - buf;
+                }
+                p++;
+                break;
+
+            // data after the end of listing
+            case JS_end:
+            default:
+                parser->failed = TRUE;
+                return p - buf;
+        }
+    }
+
+    return p - buf;
+}
+
+// entries are parsed right from received buffer,
+// only the beginning of incomplete entry is copied to wait for the rest of it
+static gboolean hfs_dir_list_json_feed (HfsDirListParser *parser, const gchar *buf, size_t buf_len)
+{
+    size_t consumed;
+
+    if (!parser->json_buf->len) {
+        consumed = hfs_dir_list_json_parse (parser, buf, buf_len);
+        if (!parser->failed)
+            g_string_append_len (parser->json_buf, buf + consumed, buf_len - consumed);
+    } else {
+        g_string_append_len (parser->json_buf, buf, buf_len);
+        consumed = hfs_dir_list_json_parse (parser, parser->json_buf->str, parser->json_buf->len);
+        if (!parser->failed)
+            g_string_erase (parser->json_buf, 0, consumed);
+    }
+
+    if (parser->failed)
+        LOG_err (DLP_LOG, "Failed to parse JSON listing !");
+
+    return !parser->failed;
+}
+/*}}}*/
+
+/*{{{ create / destroy */
+
+HfsDirListParser *hfs_dir_list_parser_create (HfsDirListFormat format,
+    HfsDirListParser_on_entry_cb on_entry_cb, gpointer ctx)
+{
+    HfsDirListParser *parser;
+
+    parser = g_new0 (HfsDirListParser, 1);
+    parser->format = format;
+    parser->on_entry_cb = on_entry_cb;
+    parser->ctx = ctx;
+
+    parser->text = g_string_new (NULL);
+    parser->name = g_string_new (NULL);
+    parser->hash = g_string_new (NULL);
+    parser->content_type = g_string_new (NULL);
+    parser->json_key = g_string_new (NULL);
+    parser->json_buf = g_string_new (NULL);
+    parser->json_state = JS_start;
+
+    // no DOM is built, elements are passed to SAX callbacks
+    if (format == DLF_xml)
+        parser->xmlctx = xmlCreatePushParserCtxt (&hfs_dir_list_xml_handler, parser, NULL, 0, NULL);
+
+    hfs_dir_list_parser_entry_reset (parser);
+
+    return parser;
+}
+
+void hfs_dir_list_parser_destroy (HfsDirListParser *parser)
+{
+    if (parser->xmlctx)
+        xmlFreeParserCtxt (parser->xmlctx);
+    g_string_free (parser->text, TRUE);
+    g_string_free (parser->name, TRUE);
+    g_string_free (parser->hash, TRUE);
+    g_string_free (parser->content_type, TRUE);
+    g_string_free (parser->json_key, TRUE);
+    g_string_free (parser->json_buf, TRUE);
+    g_free (parser);
+}
+/*}}}*/
+
+gboolean hfs_dir_list_parser_feed (HfsDirListParser *parser, const gchar *buf, size_t buf_len)
+{
+    if (parser->failed)
+        return FALSE;
+
+    if (!buf_len)
+        return TRUE;
+
+    if (parser->format == DLF_json)
+        return hfs_dir_list_json_feed (parser, buf, buf_len);
+
+    if (!parser->xmlctx || (xmlParseChunk (parser->xmlctx, buf, buf_len, 0), !parser->xmlctx->wellFormed)) {
+        LOG_err (DLP_LOG, "Failed to parse XML listing !");
+        parser->failed = TRUE;
+    }
+
+    return !parser->failed;
+}
+
+gboolean hfs_dir_list_parser_finish (HfsDirListParser *parser)
+{
+    if (parser->failed)
+        return FALSE;
+
+    if (parser->format == DLF_json)
+        return parser->json_state == JS_end && !parser->json_buf->len;
+
+    if (!parser->xmlctx)
+        return FALSE;
+
+    xmlParseChunk (parser->xmlctx, "", 0, 1);
+
+    return parser->xmlctx->wellFormed;
+}
+
+// listing of the next page starts after the last entry of this page
+// server doesn't return objects collapsed into subdir which is used as marker,
+// so the last name is used as is: any other marker can skip an object
+gchar *hfs_dir_list_next_marker (const gchar *last_name, guint page_entries, guint page_size)
+{
+    // server returns less entries than requested only for the last page
+    if (page_entries < page_size || !last_name || !*last_name)
+        return NULL;
+
+    return g_strdup (last_name);
+}
+
+const gchar *hfs_dir_list_format_to_string (HfsDirListFormat format)
+{
+    if (format == DLF_json)
+        return "json";
+    else
+        return "xml";
+}
+
+HfsDirListFormat hfs_dir_list_format_from_string (const gchar *str)
+{
+    if (str && !strcasecmp (str, "json"))
+        return DLF_json;
+    else
+        return DLF_xml;
+}
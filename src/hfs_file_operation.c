@@ -19,6 +19,7 @@
 #include "cache_mng.h"
 #include "hfs_encryption.h"
 #include "hfs_stats_srv.h"
+#include "hfs_range.h"
 
 /*{{{ struct */
 struct _HfsFileOp {
@@ -46,10 +47,30 @@ struct _HfsFileOp {
     gboolean initial_head_sent; // set TRUE if HEAD request was sent
     gboolean full_file; // send HEAD and then GET for a full file
     guint64 full_object_size;
+    guint64 dir_object_size; // object size known from DirTree, 0 if unknown
+    int backing_id; // FUSE passthrough backing file, 0 if not used
+    size_t block_size; // size of Range request, 0 - download a whole segment / file
+    gboolean head_received; // set TRUE if HEAD response is received and object size is known
+    GList *l_head_waiters; // FileOpReadData, "read" requests waiting for HEAD response
+
+    // in-flight block table, "read" requests share downloads of the same block
+    GList *l_fetches; // FileOpFetch, blocks being downloaded by readahead or by "read" requests
+
+    // readahead
+    off_t next_read_off; // expected offset of the next sequential "read"
+    guint sequential_reads; // number of sequential "read" requests in a row
+    off_t readahead_off; // end of the last prefetched block
 };
 /*}}}*/
 
 #define FOP_LOG "fop"
+// number of sequential "read" requests before readahead is started
+#define FOP_SEQUENTIAL_READS 2
+// max distance (bytes) between offsets of out-of-order "read" requests of a sequential reader
+#define FOP_READ_REORDER_WINDOW (1024 * 1024)
+
+static void hfs_fileop_readahead_cancel (HfsFileOp *fop);
+static void hfs_fileop_fetches_detach (HfsFileOp *fop);
 
 /*{{{ create / destroy */
 
@@ -71,7 +92,20 @@ HfsFileOp *hfs_fileop_create (Application *app, const gchar *fname)
     fop->write_called = FALSE;
     fop->full_file = FALSE;
     fop->full_object_size = 0;
+    fop->dir_object_size = 0;
+    fop->backing_id = 0;
+    // encrypted objects can be decrypted only as a whole
+    if (conf_get_boolean (fop->conf, "filesystem.full_object_download") || conf_get_boolean (fop->conf, "encryption.enabled"))
+        fop->block_size = 0;
+    else
+        fop->block_size = conf_get_uint (fop->conf, "filesystem.read_block_size");
     fop->l_write_data = NULL;
+    fop->next_read_off = 0;
+    fop->sequential_reads = 0;
+    fop->readahead_off = 0;
+    fop->l_fetches = NULL;
+    fop->head_received = FALSE;
+    fop->l_head_waiters = NULL;
     gettimeofday (&fop->start_tv, NULL);
     fop->total_bytes = 0;
 
@@ -89,6 +123,10 @@ void hfs_fileop_destroy (HfsFileOp *fop)
         fop->fname, fop->write_called ? "Upload" : "Download", fop->total_bytes,
         &fop->start_tv, &end_tv);
 
+    // in-flight blocks are completed without FileOp
+    hfs_fileop_fetches_detach (fop);
+    g_list_free (fop->l_head_waiters);
+
     evbuffer_free (fop->segment_buf);
     g_free (fop->fname);
     g_free (fop);
@@ -96,6 +134,22 @@ void hfs_fileop_destroy (HfsFileOp *fop)
 }
 /*}}}*/
 
+// set object size known from DirTree, lets "read" requests be served from CacheMng before HEAD request is sent
+void hfs_fileop_set_object_size (HfsFileOp *fop, guint64 size)
+{
+    fop->dir_object_size = size;
+}
+
+void hfs_fileop_set_backing_id (HfsFileOp *fop, int backing_id)
+{
+    fop->backing_id = backing_id;
+}
+
+int hfs_fileop_get_backing_id (HfsFileOp *fop)
+{
+    return fop->backing_id;
+}
+
 /*{{{ hfs_fileop_release*/
 
 // either manifest of segment buffer is sent
@@ -440,37 +494,120 @@ static void hfs_fileop_write_on_http_cb (gpointer client, gpointer ctx)
     }
 }
 
+// append data to segment buffer, without intermediate buffer
+static gboolean hfs_fileop_write_append (HfsFileOp *fop, struct fuse_bufvec *bufv, size_t buf_size, off_t off, fuse_ino_t ino)
+{
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT (buf_size);
+    struct evbuffer_iovec vec;
+    ssize_t res;
+
+    if (evbuffer_reserve_space (fop->segment_buf, buf_size, &vec, 1) < 1) {
+        LOG_err (FOP_LOG, "Failed to reserve %zu bytes in segment buffer !", buf_size);
+        return FALSE;
+    }
+    dst.buf[0].mem = vec.iov_base;
+    res = fuse_buf_copy (&dst, bufv, 0);
+    if (res < 0 || (size_t)res != buf_size) {
+        LOG_err (FOP_LOG, "Failed to copy write buffer: %s", res < 0 ? strerror (-res) : "short copy");
+        return FALSE;
+    }
+    vec.iov_len = buf_size;
+
+    // CacheMng
+    cache_mng_store_file_data (application_get_cache_mng (fop->app), 
+        ino, buf_size, off, (unsigned char *) vec.iov_base);
+
+    evbuffer_commit_space (fop->segment_buf, &vec, 1);
+    fop->current_size += buf_size;
+
+    return TRUE;
+}
+
+// kernel writeback cache sends the last partial page again when it's modified:
+// overwrite the part which is still in segment buffer, append the rest
+static gboolean hfs_fileop_write_overwrite (HfsFileOp *fop, struct fuse_bufvec *bufv, size_t buf_size, off_t off, fuse_ino_t ino)
+{
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT (buf_size);
+    size_t overlap = MIN (buf_size, fop->current_size - off);
+    struct evbuffer_ptr ptr;
+    struct evbuffer_iovec *vec;
+    unsigned char *tmp;
+    size_t done = 0;
+    ssize_t res;
+    int i, n;
+
+    tmp = g_malloc (buf_size);
+    dst.buf[0].mem = tmp;
+    res = fuse_buf_copy (&dst, bufv, 0);
+    if (res < 0 || (size_t)res != buf_size) {
+        LOG_err (FOP_LOG, "Failed to copy write buffer: %s", res < 0 ? strerror (-res) : "short copy");
+        g_free (tmp);
+        return FALSE;
+    }
+
+    evbuffer_ptr_set (fop->segment_buf, &ptr, 
+        evbuffer_get_length (fop->segment_buf) - (fop->current_size - off), EVBUFFER_PTR_SET);
+    n = evbuffer_peek (fop->segment_buf, overlap, &ptr, NULL, 0);
+    vec = g_new (struct evbuffer_iovec, n);
+    n = evbuffer_peek (fop->segment_buf, overlap, &ptr, vec, n);
+    for (i = 0; i < n && done < overlap; i++) {
+        size_t len = MIN (vec[i].iov_len, overlap - done);
+
+        memcpy (vec[i].iov_base, tmp + done, len);
+        done += len;
+    }
+    g_free (vec);
+
+    evbuffer_add (fop->segment_buf, tmp + overlap, buf_size - overlap);
+    fop->current_size += buf_size - overlap;
+
+    // CacheMng
+    cache_mng_store_file_data (application_get_cache_mng (fop->app), 
+        ino, buf_size, off, tmp);
+
+    g_free (tmp);
+    return TRUE;
+}
+
 // Add data to segment buffer
 // if segment buffer exceeds MAX size then send segment buffer to server
 // execute callback function when data either is sent or added to buffer
 void hfs_fileop_write_buffer (HfsFileOp *fop,
-    const char *buf, size_t buf_size, off_t off, fuse_ino_t ino,
+    struct fuse_bufvec *bufv, off_t off, fuse_ino_t ino,
     HfsFileOp_on_buffer_written_cb on_buffer_written_cb, gpointer ctx)
 {
+    size_t buf_size = fuse_buf_size (bufv);
+    gboolean res;
 
-    // XXX: allow only sequentially write
-    // current written bytes should be always match offset
-    /*
-    if (fop->current_size != off) {
+    if (!buf_size) {
+        on_buffer_written_cb (fop, ctx, TRUE, 0);
+        return;
+    }
+
+    // only sequential writes are allowed: current written bytes should match offset,
+    // or the rewritten range should start in data which is not uploaded yet
+    if ((size_t)off == fop->current_size) {
+        res = hfs_fileop_write_append (fop, bufv, buf_size, off, ino);
+    } else if ((size_t)off < fop->current_size && 
+        fop->current_size - off <= evbuffer_get_length (fop->segment_buf)) {
+        res = hfs_fileop_write_overwrite (fop, bufv, buf_size, off, ino);
+    } else {
         LOG_err (FOP_LOG, "Write call with offset %"OFF_FMT" is not allowed !", off);
+        res = FALSE;
+    }
+
+    if (!res) {
         on_buffer_written_cb (fop, ctx, FALSE, 0);
         return;
     }
-    */
 
     fop->total_bytes = fop->total_bytes + buf_size;
-
-    // CacheMng
-    cache_mng_store_file_data (application_get_cache_mng (fop->app), 
-        ino, buf_size, off, (unsigned char *) buf);
-
-    evbuffer_add (fop->segment_buf, buf, buf_size);
-    fop->current_size += buf_size;
     // XXX: check encrypted len
     fop->current_size_orig = fop->current_size;
     fop->write_called = TRUE;
     
     // check if we need to flush segment buffer
+    // (with writeback cache segment size is page aligned, partial last page stays in the buffer)
     if (evbuffer_get_length (fop->segment_buf) >= fop->segment_size) {
         FileOpWriteData *write_data;
         
@@ -517,14 +654,16 @@ void hfs_fileop_write_buffer (HfsFileOp *fop,
 // 4. Request selected range from Cache manager
     // 4a. Return buffer if it's found in Cache manager
 // 5. If requested object is not a Manifest - mark that we need a full object
-// 6. Determine which segment has the start of requested range:  "segment id" = "requested offset" / "segment size"
-// 7. Send request
+// 6. Determine which block has the start of requested range:
+    // 6a. "segment id" = "requested offset" / "segment size" (or 0 for a full object)
+    // 6b. block is "block size" aligned inside the segment, or the whole segment if "block size" is 0
+// 7. Send request (with Range header if block is a part of segment / object)
 // 8. On response:
 // 9. Decrypt buffer
 // 10. Add buffer to Cache manager
 // 11. if received buffer has requested range. Return it
 // 12. if received buffer has a part of requested range:
-// 12a. save part in "segment buffer"
+// 12a. save part in "block buffer"
 // 12b. correct "request offset"
 // 12c. correct "request size"
 // 12d. goto step #4
@@ -544,53 +683,112 @@ typedef struct {
     size_t segment_size; // updated segment size
 
     // used by reading
-    size_t segment_id; // id of the segment (which is in segment_buf)
-    size_t segment_pos; // position in file
+    size_t segment_id; // id of the segment, which contains block
+    off_t segment_start; // position of the segment in file
+    off_t block_start; // position of the block (which is in block_buf) in file
+    size_t block_len; // requested length of the block
 
     fuse_ino_t ino;
+    gboolean cache_checked; // whole request was looked up in CacheMng
 
-    struct evbuffer *segment_buf; // current segment buffer
+    struct evbuffer *block_buf; // current block buffer
+
+    fuse_req_t req; // FUSE "read" request
+    struct event *ev_interrupt; // request is interrupted, cancel it from event loop
 } FileOpReadData;
 
 static void hfs_fileop_read_get_buffer (FileOpReadData *read_data);
 
 static void read_data_destroy (FileOpReadData *read_data)
 {
+    if (read_data->ev_interrupt)
+        event_free (read_data->ev_interrupt);
     evbuffer_free (read_data->read_buf);
-    evbuffer_free (read_data->segment_buf);
+    evbuffer_free (read_data->block_buf);
     g_free (read_data);
 }
 
-/*{{{ Get file segment / full file */
+// pass data in memory to "read" caller
+static void hfs_fileop_read_reply (FileOpReadData *read_data, unsigned char *buf, size_t size)
+{
+    struct fuse_bufvec bufv = FUSE_BUFVEC_INIT (size);
 
-// segment buffer (or a full file) is retrieved
-// check Md5, decrypt, store to CacheMng
-static void hfs_fileop_read_on_read_cb (HttpConnection *con, void *ctx, 
-    const gchar *buf, size_t buf_len, 
-    struct evkeyvalq *headers, gboolean success)
+    bufv.buf[0].mem = buf;
+    read_data->on_buffer_read_cb (read_data->ctx, TRUE, &bufv);
+}
+
+// the whole range is in cache file: pass its descriptor to "read" caller,
+// data is spliced to FUSE device without copying it to memory
+// return FALSE if range must be retrieved from CacheMng
+static gboolean hfs_fileop_read_reply_fd (FileOpReadData *read_data, size_t size, off_t off)
 {
-    FileOpReadData *read_data = (FileOpReadData *) ctx;
-    HfsFileOp *fop = read_data->fop;
-    gboolean free_buf = FALSE;
-    unsigned char *out_buf;
-    int out_len;
-    gboolean is_encrypted = FALSE;
-    const char *encrypted_header = NULL;
-    
-    LOG_debug (FOP_LOG, "Got %zu bytes for segment: %zu", buf_len, read_data->segment_id);
+    struct fuse_bufvec bufv = FUSE_BUFVEC_INIT (size);
+    int fd;
 
-    // release HttpConnection
-    http_connection_release (con);
+    fd = cache_mng_get_file_fd (application_get_cache_mng (read_data->fop->app), read_data->ino, size, off);
+    if (fd == -1)
+        return FALSE;
 
-    if (!success) {
-        LOG_err (FOP_LOG, "Failed to retrieve segment !");
-        read_data->on_buffer_read_cb (read_data->ctx, FALSE, NULL, 0);
-        read_data_destroy (read_data);
+    bufv.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    bufv.buf[0].fd = fd;
+    bufv.buf[0].pos = off;
+    read_data->on_buffer_read_cb (read_data->ctx, TRUE, &bufv);
+    read_data_destroy (read_data);
+
+    return TRUE;
+}
+
+// calculate the segment and the block which contain "off" position
+static void hfs_fileop_get_block (HfsFileOp *fop, size_t segment_size, off_t off, 
+    size_t *segment_id, off_t *segment_start, off_t *block_start, size_t *block_len)
+{
+    size_t segment_len;
+
+    if (fop->full_file || !segment_size) {
+        *segment_id = 0;
+        *segment_start = 0;
+        segment_len = fop->full_object_size;
+    } else {
+        *segment_id = off / segment_size;
+        *segment_start = *segment_id * segment_size;
+        segment_len = segment_size;
+        if (*segment_start + segment_len > fop->full_object_size)
+            segment_len = fop->full_object_size - *segment_start;
+    }
+
+    // get a whole segment / file
+    if (!fop->block_size) {
+        *block_start = *segment_start;
+        *block_len = segment_len;
         return;
     }
 
+    *block_start = *segment_start + ((off - *segment_start) / fop->block_size) * fop->block_size;
+    *block_len = fop->block_size;
+    if (*block_start + *block_len > *segment_start + segment_len)
+        *block_len = *segment_start + segment_len - *block_start;
+}
+
+/*{{{ Get file block / segment / full file */
+
+// check Md5 and decrypt received block
+// return FALSE if block is corrupted
+static gboolean hfs_fileop_read_decode_block (Application *app, 
+    const gchar *buf, size_t buf_len, struct evkeyvalq *headers,
+    unsigned char **out_buf, int *out_len, gboolean *free_buf)
+{
+    ConfData *conf = application_get_conf (app);
+    gboolean is_encrypted = FALSE;
+    const char *encrypted_header = NULL;
+    gboolean is_partial;
+
+    *free_buf = FALSE;
+
+    // Etag header contains MD5 of a whole object, not of the requested range
+    is_partial = evhttp_find_header (headers, "Content-Range") != NULL;
+
     // MD5
-    if (conf_get_boolean (fop->conf, "filesystem.md5_enabled")) {
+    if (conf_get_boolean (conf, "filesystem.md5_enabled") && !is_partial) {
         const char *etag_header;
 
         etag_header = evhttp_find_header (headers, "Etag");
@@ -599,8 +797,8 @@ static void hfs_fileop_read_on_read_cb (HttpConnection *con, void *ctx,
             md5_sum = get_md5_sum (buf, buf_len);
             if (strcmp (etag_header, md5_sum) != 0) {
                 LOG_err (FOP_LOG, "Segment's MD5 sum doesn't match MD5 of received content !");
-                read_data->on_buffer_read_cb (read_data->ctx, FALSE, NULL, 0);
-                read_data_destroy (read_data);
+                g_free (md5_sum);
+                return FALSE;
             }  
             g_free (md5_sum);
         }
@@ -612,47 +810,28 @@ static void hfs_fileop_read_on_read_cb (HttpConnection *con, void *ctx,
         is_encrypted = TRUE;
 
     //decrypt
-    if (conf_get_boolean (fop->conf, "encryption.enabled") && is_encrypted) {
-        out_len = buf_len;
-        out_buf = hfs_encryption_decrypt (application_get_encryption (con->app), (unsigned char *)buf, &out_len);
-        free_buf = TRUE;
+    if (conf_get_boolean (conf, "encryption.enabled") && is_encrypted) {
+        *out_len = buf_len;
+        *out_buf = hfs_encryption_decrypt (application_get_encryption (app), (unsigned char *)buf, out_len);
+        *free_buf = TRUE;
         
-        /*
-        if (buf_len > out_len) {
-            // update requested size !
-            read_data->original_req_size = out_len;
-        }
-        */
-        LOG_debug (FOP_LOG, "Decrypted %d -> %d", buf_len, out_len);
+        LOG_debug (FOP_LOG, "Decrypted %zu -> %d", buf_len, *out_len);
     } else {
-        out_buf = buf;
-        out_len = buf_len;
+        *out_buf = (unsigned char *) buf;
+        *out_len = buf_len;
     }
 
-    cache_mng_store_file_data (application_get_cache_mng (fop->app), 
-        read_data->ino, out_len, read_data->segment_size * read_data->segment_id, (unsigned char *) out_buf);
-
-    // add buf to segment
-    evbuffer_add (read_data->segment_buf, out_buf, out_len);
-    hfs_fileop_read_get_buffer (read_data);
-
-    if (free_buf)
-        g_free (out_buf);
+    return TRUE;
 }
 
-// got HTTPConnection object
-// retrieve "segment" or a full file
-static void hfs_fileop_read_on_con_cb (gpointer client, gpointer ctx)
+// send GET request for a block, "segment" or a full file
+static gboolean hfs_fileop_read_request_block (HttpConnection *con, HfsFileOp *fop,
+    size_t segment_id, off_t segment_start, off_t block_start, size_t block_len,
+    HttpConnection_response_cb response_cb, gpointer ctx)
 {
-    HttpConnection *con = (HttpConnection *) client;
-    FileOpReadData *read_data = (FileOpReadData *) ctx;
-    HfsFileOp *fop = NULL;
     gchar *req_path = NULL;
     gboolean res;
-
-    http_connection_acquire (con);
-
-    fop = read_data->fop;
+    off_t range_start;
 
     // get full file
     if (fop->full_file) 
@@ -661,41 +840,466 @@ static void hfs_fileop_read_on_con_cb (gpointer client, gpointer ctx)
     // get segment
     else        
         req_path = g_strdup_printf ("/%s/%s/%zu", application_get_container_name (con->app), 
-            fop->fname, read_data->segment_id);
+            fop->fname, segment_id);
+
+    // request only a part of segment / file
+    if (fop->block_size) {
+        gchar *range;
+
+        range_start = block_start - segment_start;
+        range = g_strdup_printf ("bytes=%"OFF_FMT"-%"OFF_FMT, range_start, range_start + block_len - 1);
+        http_connection_add_output_header (con, "Range", range);
+        g_free (range);
+    }
 
     res = http_connection_make_request_to_storage_url (con, 
         req_path, "GET", NULL,
-        hfs_fileop_read_on_read_cb,
-        read_data
+        response_cb,
+        ctx
     );
 
     g_free (req_path);
 
-    if (!res) {
+    return res;
+}
+
+// add received block to block buffer and continue reading
+static void hfs_fileop_read_add_block (FileOpReadData *read_data, unsigned char *buf, int buf_len)
+{
+    unsigned char *out_buf;
+
+    // add buf to block buffer
+    evbuffer_add (read_data->block_buf, buf, buf_len);
+
+    // server returned less data than expected, return what we have got so far
+    if (!buf_len) {
+        LOG_err (FOP_LOG, "Block is empty, object is shorter than expected !");
+        out_buf = evbuffer_pullup (read_data->read_buf, -1);
+        hfs_fileop_read_reply (read_data, out_buf, evbuffer_get_length (read_data->read_buf));
+        read_data_destroy (read_data);
+        return;
+    }
+
+    hfs_fileop_read_get_buffer (read_data);
+}
+/*}}}*/
+
+/*{{{ in-flight blocks / readahead */
+
+// a block which is being downloaded by readahead or by "read" request
+typedef struct {
+    HfsFileOp *fop; // NULL if fetch is cancelled or FileOp is destroyed
+    Application *app;
+    fuse_ino_t ino;
+    gboolean readahead; // TRUE if block is requested ahead of the reader
+
+    size_t segment_id;
+    off_t segment_start;
+    off_t block_start;
+    size_t block_len;
+
+    HttpConnection *con; // connection, while GET request is in flight
+    gboolean is_range; // TRUE if only the block is requested (Range header)
+    GList *l_waiters; // FileOpReadData, "read" requests waiting for this block
+} FileOpFetch;
+
+static void hfs_fileop_readahead (HfsFileOp *fop, off_t off, fuse_ino_t ino);
+
+// find the block in the response body
+// server returns the requested range with 206 (Content-Range), or ignores Range header and returns the whole
+// segment / file with 200: then the block is cut out of it
+// return FALSE if response doesn't contain the block
+static gboolean hfs_fileop_fetch_get_range (FileOpFetch *fetch, struct evkeyvalq *headers, 
+    size_t buf_len, size_t *range_off, size_t *range_len)
+{
+    const char *range_header;
+    guint64 range_start = fetch->block_start - fetch->segment_start;
+    guint64 start;
+
+    *range_off = 0;
+    *range_len = buf_len;
+
+    if (!fetch->is_range)
+        return TRUE;
+
+    range_header = evhttp_find_header (headers, "Content-Range");
+    if (range_header) {
+        if (sscanf (range_header, "bytes %"G_GUINT64_FORMAT"-", &start) != 1 || start != range_start) {
+            LOG_err (FOP_LOG, "Server returned wrong range: %s, expected start: %"G_GUINT64_FORMAT, 
+                range_header, range_start);
+            return FALSE;
+        }
+        return TRUE;
+    }
+
+    LOG_debug (FOP_LOG, "Range is ignored by server, cutting block: %"OFF_FMT" from %zu bytes", 
+        fetch->block_start, buf_len);
+
+    // object is shorter than expected
+    if (range_start >= buf_len) {
+        *range_off = buf_len;
+        *range_len = 0;
+        return TRUE;
+    }
+
+    *range_off = range_start;
+    *range_len = MIN (fetch->block_len, buf_len - range_start);
+
+    return TRUE;
+}
+
+static void fetch_destroy (FileOpFetch *fetch)
+{
+    g_list_free (fetch->l_waiters);
+    g_free (fetch);
+}
+
+// remove fetch from the in-flight block table
+static void hfs_fileop_fetch_remove (FileOpFetch *fetch)
+{
+    if (fetch->fop)
+        fetch->fop->l_fetches = g_list_remove (fetch->fop->l_fetches, fetch);
+    fetch->fop = NULL;
+}
+
+// return fetch which is downloading data at "off" position, or NULL
+static FileOpFetch *hfs_fileop_fetch_find (HfsFileOp *fop, off_t off)
+{
+    GList *l;
+
+    for (l = g_list_first (fop->l_fetches); l; l = g_list_next (l)) {
+        FileOpFetch *fetch = (FileOpFetch *) l->data;
+
+        if (fetch->block_start <= off && off < fetch->block_start + (off_t)fetch->block_len)
+            return fetch;
+    }
+
+    return NULL;
+}
+
+// return the start of the first in-flight block after "off" and before "end", or "end"
+static off_t hfs_fileop_fetch_next_start (HfsFileOp *fop, off_t off, off_t end)
+{
+    GList *l;
+
+    for (l = g_list_first (fop->l_fetches); l; l = g_list_next (l)) {
+        FileOpFetch *fetch = (FileOpFetch *) l->data;
+
+        if (fetch->block_start > off && fetch->block_start < end)
+            end = fetch->block_start;
+    }
+
+    return end;
+}
+
+// FileOp is destroyed, let in-flight blocks complete without it
+static void hfs_fileop_fetches_detach (HfsFileOp *fop)
+{
+    while (fop->l_fetches)
+        hfs_fileop_fetch_remove ((FileOpFetch *) fop->l_fetches->data);
+}
+
+// cancel prefetches, which are not waited by "read" requests
+// the one which are already sent are completed and stored to CacheMng
+static void hfs_fileop_readahead_cancel (HfsFileOp *fop)
+{
+    GList *l, *l_next;
+
+    for (l = g_list_first (fop->l_fetches); l; l = l_next) {
+        FileOpFetch *fetch = (FileOpFetch *) l->data;
+        l_next = g_list_next (l);
+
+        if (!fetch->readahead || fetch->l_waiters)
+            continue;
+
+        LOG_debug (FOP_LOG, "Cancelling prefetch of block: %"OFF_FMT, fetch->block_start);
+        hfs_fileop_fetch_remove (fetch);
+    }
+    fop->readahead_off = 0;
+}
+
+// block download failed, remove it from the in-flight block table
+static void hfs_fileop_fetch_failed (FileOpFetch *fetch)
+{
+    gboolean retry = fetch->readahead && fetch->fop;
+    GList *l;
+
+    hfs_fileop_fetch_remove (fetch);
+
+    for (l = g_list_first (fetch->l_waiters); l; l = g_list_next (l)) {
+        FileOpReadData *read_data = (FileOpReadData *) l->data;
+
+        // let "read" requests download block by themselves
+        if (retry) {
+            hfs_fileop_read_get_buffer (read_data);
+        } else {
+            read_data->on_buffer_read_cb (read_data->ctx, FALSE, NULL);
+            read_data_destroy (read_data);
+        }
+    }
+}
+
+// block is retrieved, store it to CacheMng and pass to waiting "read" requests
+static void hfs_fileop_fetch_on_read_cb (HttpConnection *con, void *ctx, 
+    const gchar *buf, size_t buf_len, 
+    struct evkeyvalq *headers, gboolean success)
+{
+    FileOpFetch *fetch = (FileOpFetch *) ctx;
+    HfsFileOp *fop = fetch->fop;
+    gboolean free_buf = FALSE;
+    unsigned char *out_buf = NULL;
+    int out_len = 0;
+    size_t range_off;
+    size_t range_len;
+    GList *l;
+    
+    LOG_debug (FOP_LOG, "Got %zu bytes for block: %"OFF_FMT" (segment: %zu)", buf_len, fetch->block_start, fetch->segment_id);
+
+    // release HttpConnection
+    fetch->con = NULL;
+    http_connection_release (con);
+
+    if (!success || !hfs_fileop_read_decode_block (fetch->app, buf, buf_len, headers, &out_buf, &out_len, &free_buf)) {
+        LOG_err (FOP_LOG, "Failed to retrieve block !");
+        hfs_fileop_fetch_failed (fetch);
+        fetch_destroy (fetch);
+        return;
+    }
+
+    if (!hfs_fileop_fetch_get_range (fetch, headers, out_len, &range_off, &range_len)) {
+        if (free_buf)
+            g_free (out_buf);
+        hfs_fileop_fetch_failed (fetch);
+        fetch_destroy (fetch);
+        return;
+    }
+
+    hfs_fileop_fetch_remove (fetch);
+
+    cache_mng_store_file_data (application_get_cache_mng (fetch->app), 
+        fetch->ino, range_len, fetch->block_start, out_buf + range_off);
+
+    for (l = g_list_first (fetch->l_waiters); l; l = g_list_next (l)) {
+        FileOpReadData *read_data = (FileOpReadData *) l->data;
+
+        evbuffer_drain (read_data->block_buf, -1);
+        read_data->block_start = fetch->block_start;
+        hfs_fileop_read_add_block (read_data, out_buf + range_off, range_len);
+    }
+
+    if (free_buf)
+        g_free (out_buf);
+
+    // keep the pipeline full
+    if (fop)
+        hfs_fileop_readahead (fop, fop->next_read_off, fetch->ino);
+
+    fetch_destroy (fetch);
+}
+
+// got HTTPConnection object
+// retrieve block, "segment" or a full file
+static void hfs_fileop_fetch_on_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileOpFetch *fetch = (FileOpFetch *) ctx;
+
+    http_connection_acquire (con);
+
+    // fetch was cancelled while waiting for connection, pass connection to the next request
+    if (!fetch->fop) {
+        http_connection_release (con);
+        hfs_fileop_fetch_failed (fetch);
+        fetch_destroy (fetch);
+        return;
+    }
+
+    fetch->is_range = fetch->fop->block_size != 0;
+    if (!hfs_fileop_read_request_block (con, fetch->fop, 
+        fetch->segment_id, fetch->segment_start, fetch->block_start, fetch->block_len,
+        hfs_fileop_fetch_on_read_cb, fetch)) {
         LOG_err (FOP_LOG, "Failed to create HTTP request !");
         http_connection_release (con);
-        read_data->on_buffer_read_cb (read_data->ctx, FALSE, NULL, 0);
-        read_data_destroy (read_data);
+        hfs_fileop_fetch_failed (fetch);
+        fetch_destroy (fetch);
         return;
     }
+    fetch->con = con;
+}
+
+// nobody waits for the block anymore: stop downloading it
+// HTTP request is cancelled and connection is returned to the pool right away
+static void hfs_fileop_fetch_cancel (FileOpFetch *fetch)
+{
+    LOG_debug (FOP_LOG, "Cancelling download of block: %"OFF_FMT" len: %zu", fetch->block_start, fetch->block_len);
+
+    hfs_fileop_fetch_remove (fetch);
+
+    // still waiting for HttpConnection, hfs_fileop_fetch_on_con_cb passes it to the next request
+    if (!fetch->con)
+        return;
+
+    http_connection_cancel_request (fetch->con);
+    http_connection_release (fetch->con);
+    fetch_destroy (fetch);
+}
+
+// add block to the in-flight block table and start downloading it, "read_data" (if not NULL) waits for the block
+// return FALSE if HTTP client can't be acquired
+static gboolean hfs_fileop_fetch_start (HfsFileOp *fop, fuse_ino_t ino, gboolean readahead, 
+    size_t segment_id, off_t segment_start, off_t block_start, size_t block_len, FileOpReadData *read_data)
+{
+    FileOpFetch *fetch;
+
+    fetch = g_new0 (FileOpFetch, 1);
+    fetch->fop = fop;
+    fetch->app = fop->app;
+    fetch->ino = ino;
+    fetch->readahead = readahead;
+    fetch->segment_id = segment_id;
+    fetch->segment_start = segment_start;
+    fetch->block_start = block_start;
+    fetch->block_len = block_len;
+    if (read_data)
+        fetch->l_waiters = g_list_append (fetch->l_waiters, read_data);
+
+    // connection could be ready right away
+    fop->l_fetches = g_list_append (fop->l_fetches, fetch);
+    if (!client_pool_get_client (application_get_read_client_pool (fop->app), hfs_fileop_fetch_on_con_cb, fetch)) {
+        LOG_debug (FOP_LOG, "Failed to get HTTP client !");
+        hfs_fileop_fetch_remove (fetch);
+        fetch_destroy (fetch);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// keep up to "readahead_uploads" blocks ahead of the reader downloaded or in flight,
+// but no more than "parallel_downloads" requests at a time
+static void hfs_fileop_readahead (HfsFileOp *fop, off_t off, fuse_ino_t ino)
+{
+    guint max_blocks = conf_get_uint (fop->conf, "filesystem.readahead_uploads");
+    guint max_requests = conf_get_uint (fop->conf, "filesystem.parallel_downloads");
+    guint i;
+    size_t segment_id;
+    off_t segment_start;
+    off_t block_start;
+    size_t block_len;
+
+    // stream doesn't look sequential or object size is still unknown
+    if (fop->sequential_reads < FOP_SEQUENTIAL_READS || !fop->full_object_size)
+        return;
+
+    // prefetched blocks are passed to reader via CacheMng
+    if (!conf_get_boolean (fop->conf, "filesystem.cache_enabled"))
+        return;
+
+    for (i = 0; i < max_blocks && (guint64)off < fop->full_object_size; i++) {
+        if (g_list_length (fop->l_fetches) >= max_requests)
+            break;
+
+        hfs_fileop_get_block (fop, fop->segment_size, off, 
+            &segment_id, &segment_start, &block_start, &block_len);
+        off = block_start + block_len;
+
+        // already requested
+        if (off <= fop->readahead_off)
+            continue;
+        fop->readahead_off = off;
+
+        if (cache_mng_contain_file_data (application_get_cache_mng (fop->app), ino, block_len, block_start) ||
+            hfs_fileop_fetch_find (fop, block_start))
+            continue;
+
+        if (!hfs_fileop_fetch_start (fop, ino, TRUE, segment_id, segment_start, block_start, block_len, NULL)) {
+            fop->readahead_off = block_start;
+            break;
+        }
+        LOG_debug (FOP_LOG, "Prefetching block: %"OFF_FMT" len: %zu", block_start, block_len);
+    }
 }
 /*}}}*/
 
-// check if current segment buffer contains requested buffer
+// add "len" bytes to read buffer, reply if request is filled or continue reading
+static void hfs_fileop_read_add_data (FileOpReadData *read_data, unsigned char *buf, size_t len)
+{
+    unsigned char *out_buf;
+
+    evbuffer_add (read_data->read_buf, buf, len);
+
+    // update
+    read_data->current_off = read_data->current_off + len;
+    read_data->size_left = read_data->size_left - len;
+
+    // check if buffer is filled
+    if (!read_data->size_left) {
+        // return whole read_buffer
+        out_buf = evbuffer_pullup (read_data->read_buf, -1);
+        hfs_fileop_read_reply (read_data, out_buf, evbuffer_get_length (read_data->read_buf));
+        read_data_destroy (read_data);
+    // send a new request
+    } else {
+        hfs_fileop_read_get_buffer (read_data);
+    }
+}
+
+// download block described by read_data, other "read" requests can wait for it
+static void hfs_fileop_read_fetch_block (FileOpReadData *read_data)
+{
+    if (!hfs_fileop_fetch_start (read_data->fop, read_data->ino, FALSE, 
+        read_data->segment_id, read_data->segment_start, read_data->block_start, read_data->block_len, read_data)) {
+        LOG_err (FOP_LOG, "Failed to get HTTP client !");
+        read_data->on_buffer_read_cb (read_data->ctx, FALSE, NULL);
+        read_data_destroy (read_data);
+    }
+}
+
+// whole request is looked up in CacheMng
+static void hfs_fileop_read_on_cache_cb (gpointer ctx, gboolean success, unsigned char *buf, size_t size)
+{
+    FileOpReadData *read_data = (FileOpReadData *) ctx;
+
+    if (!success) {
+        hfs_fileop_read_get_buffer (read_data);
+        return;
+    }
+
+    hfs_fileop_read_reply (read_data, buf, size);
+    read_data_destroy (read_data);
+}
+
+// cached part of the block is read from CacheMng
+static void hfs_fileop_read_on_cached_part_cb (gpointer ctx, gboolean success, unsigned char *buf, size_t size)
+{
+    FileOpReadData *read_data = (FileOpReadData *) ctx;
+
+    if (!success) {
+        hfs_fileop_read_fetch_block (read_data);
+        return;
+    }
+
+    LOG_debug (FOP_LOG, "Got %zu bytes from cache, off: %"OFF_FMT, size, read_data->current_off);
+    hfs_fileop_read_add_data (read_data, buf, size);
+}
+
+// check if current block buffer or CacheMng contains requested buffer
+// otherwise download the missing part of the block
 static void hfs_fileop_read_get_buffer (FileOpReadData *read_data)
 {
     HfsFileOp *fop = read_data->fop;
-    off_t segment_start_id;
-    size_t segment_len;
+    size_t segment_id;
+    off_t segment_start;
+    off_t block_start;
+    size_t block_len;
+    off_t fetch_start;
+    size_t fetch_len;
+    size_t buf_len;
     unsigned char *buf;
     off_t start_pos;
     size_t len;
+    FileOpFetch *fetch;
 
-    // get segmentID of the beginning
-    segment_start_id = read_data->current_off / read_data->segment_size;
-    // current segment buf length
-    segment_len = evbuffer_get_length (read_data->segment_buf);
-    
     // check that request does not exceed the object size
     if (read_data->current_off + read_data->size_left > fop->full_object_size) {
         LOG_err (FOP_LOG, "Updating request size, object size: %lu", fop->full_object_size);
@@ -704,95 +1308,134 @@ static void hfs_fileop_read_get_buffer (FileOpReadData *read_data)
             read_data->original_req_size = 0;
         } else {
             read_data->size_left = fop->full_object_size - read_data->current_off;
-            read_data->original_req_size = fop->full_object_size - read_data->current_off;
+            read_data->original_req_size = read_data->current_off + read_data->size_left - read_data->original_req_off;
         }
     }
 
-    LOG_debug (FOP_LOG, "current segment: %zu, segment len: %zu,  requested segment: %zu, req size: %zu, got so far: %zu of %zu, current off: %zu",
-        read_data->segment_id, segment_len, segment_start_id, read_data->size_left, evbuffer_get_length (read_data->read_buf), 
-        read_data->size_left, read_data->current_off);
+    // retrieve whole request from cache, continue in hfs_fileop_read_on_cache_cb
+    if (!read_data->cache_checked) {
+        read_data->cache_checked = TRUE;
+        if (hfs_fileop_read_reply_fd (read_data, read_data->original_req_size, read_data->original_req_off))
+            return;
+        cache_mng_retr_file_data (application_get_cache_mng (fop->app), 
+            read_data->ino, read_data->original_req_size, read_data->original_req_off,
+            hfs_fileop_read_on_cache_cb, read_data);
+        return;
+    }
+
+    // nothing left to read (EOF)
+    if (!read_data->size_left) {
+        buf = evbuffer_pullup (read_data->read_buf, -1);
+        hfs_fileop_read_reply (read_data, buf, evbuffer_get_length (read_data->read_buf));
+        read_data_destroy (read_data);
+        return;
+    }
 
-    LOG_debug (FOP_LOG, "Expected seg size: %zu, actual: %zu", read_data->segment_size, evbuffer_get_length (read_data->segment_buf));
+    // current block buffer length
+    buf_len = evbuffer_get_length (read_data->block_buf);
 
-    // retrieve from cache
-    /*
-    buf = cache_mng_retr_file_data (application_get_cache_mng (fop->app), 
-        read_data->ino, read_data->size_left, read_data->current_off);
-    */
-    buf = cache_mng_retr_file_data (application_get_cache_mng (fop->app), 
-        read_data->ino, read_data->original_req_size, read_data->original_req_off);
-    if (buf) {
-        // empty buffer
-        evbuffer_drain (read_data->segment_buf, -1);
-
-        // verify
-        /*
-        if (read_data->size_left != read_data->original_req_size) {
-            LOG_err (FOP_LOG, "Read buffer does not match requested size: %zu != %zu",
-               read_data->size_left , read_data->original_req_size);
-        }
-        */
+    // current block buffer contains requested position
+    if (buf_len && read_data->current_off >= read_data->block_start && 
+        (size_t)(read_data->current_off - read_data->block_start) < buf_len) {
+        // start pos in the current buffer
+        start_pos = read_data->current_off - read_data->block_start;
+        buf = evbuffer_pullup (read_data->block_buf, -1);
+        // length to get from the current buffer
+        len = MIN (buf_len - start_pos, read_data->size_left);
 
-        read_data->on_buffer_read_cb (read_data->ctx, TRUE, (char *)buf, read_data->original_req_size);
-        read_data_destroy (read_data);
-        g_free (buf);
+        LOG_debug (FOP_LOG, "block_buf size: %zu,  start_pos: %"OFF_FMT"   len: %zu", buf_len, start_pos, len);
+
+        hfs_fileop_read_add_data (read_data, buf + start_pos, len);
         return;
-    } else {
-        // LOG_err (FOP_LOG, "Hit miss");
     }
 
-    // current segment buffer has different ID or empty
-    if (segment_start_id != read_data->segment_id || !segment_len) {
-        // empty buffer
-        evbuffer_drain (read_data->segment_buf, -1);
+    hfs_fileop_get_block (fop, read_data->segment_size, read_data->current_off, 
+        &segment_id, &segment_start, &block_start, &block_len);
+    fetch_start = block_start;
+    fetch_len = block_len;
 
-        // set segmentID
-        read_data->segment_id = segment_start_id;
+    LOG_debug (FOP_LOG, "requested block: %"OFF_FMT", req size: %zu, got so far: %zu, current off: %"OFF_FMT,
+        block_start, read_data->size_left, evbuffer_get_length (read_data->read_buf), read_data->current_off);
 
-        // get HTTP connection to download segment 
-        if (!client_pool_get_client (application_get_read_client_pool (fop->app), hfs_fileop_read_on_con_cb, read_data)) {
-            LOG_err (FOP_LOG, "Failed to get HTTP client !");
-            read_data->on_buffer_read_cb (read_data->ctx, FALSE, NULL, 0);
-            read_data_destroy (read_data);
+    // requested position is already being downloaded by readahead or by another "read" request
+    fetch = hfs_fileop_fetch_find (fop, read_data->current_off);
+
+    // block can be downloaded partially: use cached part or download only the missing part of block
+    if (fop->block_size && !fetch) {
+        GList *l_segments;
+        HfsRangeSegment *seg;
+
+        l_segments = cache_mng_get_file_ranges (application_get_cache_mng (fop->app), read_data->ino, 
+            block_start + block_len - read_data->current_off, read_data->current_off);
+        seg = (HfsRangeSegment *) g_list_nth_data (l_segments, 0);
+
+        // cached prefix, the rest of block is downloaded if cache read fails
+        if (seg && seg->covered) {
+            len = MIN (seg->end - seg->start, read_data->size_left);
+            g_list_free_full (l_segments, g_free);
+
+            evbuffer_drain (read_data->block_buf, -1);
+            read_data->segment_id = segment_id;
+            read_data->segment_start = segment_start;
+            read_data->block_start = read_data->current_off;
+            read_data->block_len = block_start + block_len - read_data->current_off;
+
+            cache_mng_retr_file_data (application_get_cache_mng (fop->app), 
+                read_data->ino, len, read_data->current_off, 
+                hfs_fileop_read_on_cached_part_cb, read_data);
             return;
+        } else {
+            // missing part of the block
+            fetch_start = read_data->current_off;
+            fetch_len = seg ? seg->end - seg->start : block_start + block_len - read_data->current_off;
+            g_list_free_full (l_segments, g_free);
+            // don't download bytes which are already in flight
+            fetch_len = hfs_fileop_fetch_next_start (fop, fetch_start, fetch_start + fetch_len) - fetch_start;
         }
+    }
+
+    // empty buffer
+    evbuffer_drain (read_data->block_buf, -1);
+
+    read_data->segment_id = segment_id;
+    read_data->segment_start = segment_start;
+    read_data->block_start = fetch_start;
+    read_data->block_len = fetch_len;
 
+    if (fetch) {
+        LOG_debug (FOP_LOG, "Waiting for in-flight block: %"OFF_FMT, fetch->block_start);
+        read_data->block_start = fetch->block_start;
+        read_data->block_len = fetch->block_len;
+        fetch->l_waiters = g_list_append (fetch->l_waiters, read_data);
         return;
     }
 
-    // we have the right segment buffer
-    buf = evbuffer_pullup (read_data->segment_buf, -1);
-    // start pos in the current buffer
-    start_pos = read_data->current_off - (read_data->segment_size * segment_start_id);
-    // length to get from the current buffer
-    len = read_data->segment_size - start_pos;
-    // whole request is in the current buffer
-    if (read_data->size_left <= len)
-        len = read_data->size_left;
+    hfs_fileop_read_fetch_block (read_data);
+}
 
-    LOG_debug (FOP_LOG, "segment_buf size: %zu,  start_pos: %zu   len: %zu",  evbuffer_get_length (read_data->segment_buf), start_pos, len);
+/*{{{ initial HEAD request */
+// HEAD request failed: fail all waiting "read" requests, the next one sends HEAD again
+static void hfs_fileop_read_head_failed (FileOpReadData *read_data)
+{
+    HfsFileOp *fop = read_data->fop;
+    GList *l_waiters, *l;
 
-    evbuffer_add (read_data->read_buf, buf + start_pos, len);
+    fop->initial_head_sent = FALSE;
+    l_waiters = fop->l_head_waiters;
+    fop->l_head_waiters = NULL;
 
-    // update
-    read_data->current_off = read_data->current_off + len;
-    read_data->size_left = read_data->size_left - len;
+    read_data->on_buffer_read_cb (read_data->ctx, FALSE, NULL);
+    read_data_destroy (read_data);
 
-    LOG_debug (FOP_LOG, "start_pos: %zu len: %zu current_off: %zu size_left: %zu", start_pos, len, read_data->current_off, read_data->size_left);
+    for (l = g_list_first (l_waiters); l; l = g_list_next (l)) {
+        FileOpReadData *waiter = (FileOpReadData *) l->data;
 
-    // check if buffer is filled
-    if (!read_data->size_left) {
-        // return whole read_buffer
-        buf = evbuffer_pullup (read_data->read_buf, -1);
-        read_data->on_buffer_read_cb (read_data->ctx, TRUE, (char *)buf, evbuffer_get_length (read_data->read_buf));
-        read_data_destroy (read_data);
-    // send a new request
-    } else {
-        hfs_fileop_read_get_buffer (read_data);
+        waiter->on_buffer_read_cb (waiter->ctx, FALSE, NULL);
+        read_data_destroy (waiter);
     }
+    g_list_free (l_waiters);
 }
 
-/*{{{ initial HEAD request */
 // manifest or a full file is retrieved
 static void hfs_fileop_read_manifest_on_read_cb (HttpConnection *con, void *ctx, 
     const gchar *buf, size_t buf_len, 
@@ -806,16 +1449,16 @@ static void hfs_fileop_read_manifest_on_read_cb (HttpConnection *con, void *ctx,
     const char *manifest_header;
     const char *size_header;
     const char *object_size_header;
+    GList *l_waiters, *l;
 
-    LOG_debug (FOP_LOG, "Got %zu bytes for manifest: %zu", buf_len, read_data->segment_id);
+    LOG_debug (FOP_LOG, "Got %zu bytes for manifest", buf_len);
 
     // release HttpConnection
     http_connection_release (con);
 
     if (!success) {
         LOG_err (FOP_LOG, "Failed to retrieve segment !");
-        read_data->on_buffer_read_cb (read_data->ctx, FALSE, NULL, 0);
-        read_data_destroy (read_data);
+        hfs_fileop_read_head_failed (read_data);
         return;
     }
 
@@ -825,8 +1468,7 @@ static void hfs_fileop_read_manifest_on_read_cb (HttpConnection *con, void *ctx,
         fop->full_object_size = strtoll ((char *)size_header, NULL, 10);
     } else {
         LOG_err (FOP_LOG, "Failed to retrieve header !");
-        read_data->on_buffer_read_cb (read_data->ctx, FALSE, NULL, 0);
-        read_data_destroy (read_data);
+        hfs_fileop_read_head_failed (read_data);
         return;
     }
 
@@ -858,8 +1500,22 @@ static void hfs_fileop_read_manifest_on_read_cb (HttpConnection *con, void *ctx,
         fop->full_file = TRUE;
     }
 
+    fop->head_received = TRUE;
+    l_waiters = fop->l_head_waiters;
+    fop->l_head_waiters = NULL;
+
     // start downloading segments / file
     hfs_fileop_read_get_buffer (read_data);
+
+    // continue "read" requests received while HEAD request was in flight
+    for (l = g_list_first (l_waiters); l; l = g_list_next (l)) {
+        FileOpReadData *waiter = (FileOpReadData *) l->data;
+
+        waiter->segment_size = fop->segment_size;
+        hfs_fileop_readahead (fop, waiter->original_req_off, waiter->ino);
+        hfs_fileop_read_get_buffer (waiter);
+    }
+    g_list_free (l_waiters);
 }
 
 // Send Head request to get manifest or a full file Meta data
@@ -889,30 +1545,112 @@ static void hfs_fileop_read_manifest_on_con_cb (gpointer client, gpointer ctx)
     if (!res) {
         LOG_err (FOP_LOG, "Failed to create HTTP request !");
         http_connection_release (con);
-        read_data->on_buffer_read_cb (read_data->ctx, FALSE, NULL, 0);
+        hfs_fileop_read_head_failed (read_data);
+        return;
+    }
+}
+/*}}}*/
+
+/*{{{ interrupt */
+// FUSE request is interrupted: stop waiting for HEAD response or for the block
+// data which is not needed by other requests is not downloaded
+static void hfs_fileop_read_on_interrupt_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short what, void *arg)
+{
+    FileOpReadData *read_data = (FileOpReadData *) arg;
+    HfsFileOp *fop = read_data->fop;
+    GList *l;
+
+    if (g_list_find (fop->l_head_waiters, read_data)) {
+        LOG_debug (FOP_LOG, "[%p] Read interrupted while waiting for HEAD response", read_data->req);
+        fop->l_head_waiters = g_list_remove (fop->l_head_waiters, read_data);
+        read_data->on_buffer_read_cb (read_data->ctx, FALSE, NULL);
+        read_data_destroy (read_data);
+        return;
+    }
+
+    for (l = g_list_first (fop->l_fetches); l; l = g_list_next (l)) {
+        FileOpFetch *fetch = (FileOpFetch *) l->data;
+
+        if (!g_list_find (fetch->l_waiters, read_data))
+            continue;
+
+        LOG_debug (FOP_LOG, "[%p] Read interrupted while waiting for block: %"OFF_FMT, read_data->req, fetch->block_start);
+        fetch->l_waiters = g_list_remove (fetch->l_waiters, read_data);
+        // prefetched blocks are completed and stored to CacheMng
+        if (!fetch->l_waiters && !fetch->readahead)
+            hfs_fileop_fetch_cancel (fetch);
+
+        read_data->on_buffer_read_cb (read_data->ctx, FALSE, NULL);
         read_data_destroy (read_data);
         return;
     }
+
+    // HEAD request or cache lookup is in progress, request completes as usual
+    LOG_debug (FOP_LOG, "[%p] Read interrupted, but it is not waiting for download", read_data->req);
+}
+
+// called by libfuse when kernel interrupts request, possibly right from fuse_req_interrupt_func ():
+// request can't be replied here, cancellation is deferred to the next event loop iteration
+static void hfs_fileop_read_on_interrupt (G_GNUC_UNUSED fuse_req_t req, void *data)
+{
+    FileOpReadData *read_data = (FileOpReadData *) data;
+    struct timeval tv = {0, 0};
+
+    if (read_data->ev_interrupt)
+        return;
+
+    read_data->ev_interrupt = evtimer_new (application_get_evbase (read_data->fop->app), 
+        hfs_fileop_read_on_interrupt_cb, read_data);
+    evtimer_add (read_data->ev_interrupt, &tv);
 }
 /*}}}*/
 
+static void hfs_fileop_read_start (FileOpReadData *read_data);
+
+// request is looked up in CacheMng before HEAD request
+static void hfs_fileop_read_on_early_cache_cb (gpointer ctx, gboolean success, unsigned char *buf, size_t size)
+{
+    FileOpReadData *read_data = (FileOpReadData *) ctx;
+
+    if (!success) {
+        hfs_fileop_read_start (read_data);
+        return;
+    }
+
+    LOG_debug (FOP_LOG, "Read from cache without HEAD request, size: %zu, off: %"OFF_FMT, size, read_data->original_req_off);
+    hfs_fileop_read_reply (read_data, buf, size);
+    read_data_destroy (read_data);
+}
+
 // Init read_data
 // Get HTTPConnection object for HEAD request
 // or continue handing "read ()" call
 void hfs_fileop_read_buffer (HfsFileOp *fop,
-    size_t size, off_t off, fuse_ino_t ino,
+    size_t size, off_t off, fuse_ino_t ino, fuse_req_t req,
     HfsFileOp_on_buffer_read_cb on_buffer_read_cb, gpointer ctx)
 {
     FileOpReadData *read_data;
     
     fop->total_bytes = fop->total_bytes + size;
-    
+
+    // detect sequential access, drop readahead on seek
+    // concurrent "read" requests of a sequential reader can arrive slightly out of order
+    if (off >= fop->next_read_off - FOP_READ_REORDER_WINDOW && off <= fop->next_read_off + FOP_READ_REORDER_WINDOW) {
+        fop->sequential_reads++;
+        fop->next_read_off = MAX (fop->next_read_off, (off_t)(off + size));
+    } else {
+        fop->sequential_reads = 0;
+        hfs_fileop_readahead_cancel (fop);
+        fop->next_read_off = off + size;
+    }
+
     read_data = g_new0 (FileOpReadData, 1);
     // various data
     read_data->fop = fop;
     read_data->on_buffer_read_cb = on_buffer_read_cb;
     read_data->ctx = ctx;
     read_data->ino = ino;
+    read_data->req = req;
 
     // set default segment size
     read_data->segment_size = fop->segment_size;
@@ -921,8 +1659,8 @@ void hfs_fileop_read_buffer (HfsFileOp *fop,
     
     // buffer with data to send back to read () caller
     read_data->read_buf = evbuffer_new ();
-    // decrypted segment
-    read_data->segment_buf = evbuffer_new ();
+    // decrypted block
+    read_data->block_buf = evbuffer_new ();
 
     read_data->size_left = size;
     read_data->current_off = off;
@@ -931,6 +1669,34 @@ void hfs_fileop_read_buffer (HfsFileOp *fop,
     read_data->original_req_size = size;
     read_data->original_req_off = off;
 
+    // HEAD response is not received yet, try to answer from CacheMng
+    // object size is known from DirTree, cached data is dropped by DirTree when object is changed
+    if (!fop->head_received && fop->dir_object_size) {
+        if ((guint64)off >= fop->dir_object_size)
+            size = 0;
+        else if (off + size > fop->dir_object_size)
+            size = fop->dir_object_size - off;
+
+        if (hfs_fileop_read_reply_fd (read_data, size, off))
+            return;
+        cache_mng_retr_file_data (application_get_cache_mng (fop->app), ino, size, off, 
+            hfs_fileop_read_on_early_cache_cb, read_data);
+        return;
+    }
+
+    hfs_fileop_read_start (read_data);
+}
+
+// send HEAD request or continue reading
+static void hfs_fileop_read_start (FileOpReadData *read_data)
+{
+    HfsFileOp *fop = read_data->fop;
+
+    // data has to be downloaded, stop waiting for it if process is killed or "read" is interrupted
+    // libfuse unregisters callback when request is replied
+    if (read_data->req)
+        fuse_req_interrupt_func (read_data->req, hfs_fileop_read_on_interrupt, read_data);
+
     if (!fop->initial_head_sent) {
         fop->initial_head_sent = TRUE;
         LOG_debug (FOP_LOG, "Sending HEAD request !");
@@ -938,11 +1704,16 @@ void hfs_fileop_read_buffer (HfsFileOp *fop,
         // get HTTP connection to download manifest or a full file
         if (!client_pool_get_client (application_get_read_client_pool (fop->app), hfs_fileop_read_manifest_on_con_cb, read_data)) {
             LOG_err (FOP_LOG, "Failed to get HTTP client !");
-            read_data->on_buffer_read_cb (read_data->ctx, FALSE, NULL, 0);
-            read_data_destroy (read_data);
+            hfs_fileop_read_head_failed (read_data);
         }
+    } else if (!fop->head_received) {
+        // object size is unknown until HEAD response is received
+        LOG_debug (FOP_LOG, "Waiting for HEAD response");
+        fop->l_head_waiters = g_list_append (fop->l_head_waiters, read_data);
     } else {
         LOG_debug (FOP_LOG, "Continue downloading segments");
+        // start downloading blocks ahead, including the requested one
+        hfs_fileop_readahead (fop, read_data->original_req_off, read_data->ino);
         // start downloading segments
         hfs_fileop_read_get_buffer (read_data);
     }
@@ -15,6 +15,7 @@
 */
 #include "hfs_fuse.h"
 #include "dir_tree.h"
+#include <poll.h>
 
 /*{{{ struct / defines */
 
@@ -25,17 +26,36 @@ struct _HfsFuse {
     
     // the session that we use to process the fuse stuff
     struct fuse_session *session;
-    struct fuse_chan *chan;
     // the event that we use to receive requests
     struct event *ev;
     struct event *ev_timer;
     // what our receive-message length is
     size_t recv_size;
-    // the buffer that we use to receive events
-    char *recv_buf;
+    // the buffer that we use to receive requests, allocated by libfuse
+    struct fuse_buf recv_fbuf;
+    // max number of requests processed per event loop wakeup
+    guint requests_per_wakeup;
+
+    // time (seconds) kernel caches names, attributes and missing names
+    double entry_timeout;
+    double attr_timeout;
+    double negative_timeout;
+
+    // kernel cache invalidations are sent from a separate thread:
+    // notification blocks until kernel drops the pages, which may wait for a READ reply from the event loop
+    GThreadPool *inval_pool; // HfsFuseInval
 };
 
+typedef struct {
+    fuse_ino_t ino; // inode, or parent inode if name is set
+    gchar *name; // entry name for entry invalidation, NULL for inode invalidation
+} HfsFuseInval;
+
 #define FUSE_LOG "fuse"
+
+// max size of request: the largest WRITE request (256 pages) plus header
+#define FUSE_MAX_PAGES 256
+#define FUSE_HEADER_SIZE 0x1000
 /*}}}*/
 
 /*{{{ func declarations */
@@ -43,30 +63,34 @@ static void hfs_fuse_init (void *userdata, struct fuse_conn_info *conn);
 static void hfs_fuse_on_read (evutil_socket_t fd, short what, void *arg);
 static void hfs_fuse_readdir (fuse_req_t req, fuse_ino_t ino, 
     size_t size, off_t off, struct fuse_file_info *fi);
+static void hfs_fuse_readdirplus (fuse_req_t req, fuse_ino_t ino, 
+    size_t size, off_t off, struct fuse_file_info *fi);
 static void hfs_fuse_lookup (fuse_req_t req, fuse_ino_t parent_ino, const char *name);
 static void hfs_fuse_getattr (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
 static void hfs_fuse_setattr (fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi);
 static void hfs_fuse_open (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
 static void hfs_fuse_release (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
 static void hfs_fuse_read (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi);
-static void hfs_fuse_write (fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi);
+static void hfs_fuse_write_buf (fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv, off_t off, struct fuse_file_info *fi);
 static void hfs_fuse_create (fuse_req_t req, fuse_ino_t parent_ino, const char *name, mode_t mode, struct fuse_file_info *fi);
-static void hfs_fuse_forget (fuse_req_t req, fuse_ino_t ino, unsigned long nlookup);
+static void hfs_fuse_forget (fuse_req_t req, fuse_ino_t ino, uint64_t nlookup);
 static void hfs_fuse_unlink (fuse_req_t req, fuse_ino_t parent_ino, const char *name);
 static void hfs_fuse_mkdir (fuse_req_t req, fuse_ino_t parent_ino, const char *name, mode_t mode);
 static void hfs_fuse_rmdir (fuse_req_t req, fuse_ino_t parent_ino, const char *name);
 static void hfs_fuse_on_timer (evutil_socket_t fd, short what, void *arg);
+static void hfs_fuse_inval_worker (gpointer data, gpointer user_data);
 
 static struct fuse_lowlevel_ops hfs_fuse_opers = {
     .init       = hfs_fuse_init,
 	.readdir	= hfs_fuse_readdir,
+	.readdirplus	= hfs_fuse_readdirplus,
 	.lookup		= hfs_fuse_lookup,
     .getattr	= hfs_fuse_getattr,
     .setattr	= hfs_fuse_setattr,
 	.open		= hfs_fuse_open,
 	.release	= hfs_fuse_release,
 	.read		= hfs_fuse_read,
-	.write		= hfs_fuse_write,
+	.write_buf	= hfs_fuse_write_buf,
 	.create		= hfs_fuse_create,
     .forget     = hfs_fuse_forget,
     .unlink     = hfs_fuse_unlink,
@@ -90,12 +114,13 @@ HfsFuse *hfs_fuse_new (Application *app, const gchar *mountpoint, const gchar *f
     hfs_fuse->dir_tree = application_get_dir_tree (app);
     hfs_fuse->mountpoint = g_strdup (mountpoint);
 
-    if (fuse_opts) {
-        if (fuse_opt_add_arg (&args, "hydrafs") == -1) {
-            LOG_err (FUSE_LOG, "Failed to parse FUSE parameter !");
-            return NULL;
-        }
+    // program name is required by fuse_session_new
+    if (fuse_opt_add_arg (&args, "hydrafs") == -1) {
+        LOG_err (FUSE_LOG, "Failed to parse FUSE parameter !");
+        return NULL;
+    }
 
+    if (fuse_opts) {
         if (fuse_opt_add_arg (&args, "-o") == -1) {
             LOG_err (FUSE_LOG, "Failed to parse FUSE parameter !");
             return NULL;
@@ -107,32 +132,35 @@ HfsFuse *hfs_fuse_new (Application *app, const gchar *mountpoint, const gchar *f
         }
     }
     
-    if ((hfs_fuse->chan = fuse_mount (hfs_fuse->mountpoint, &args)) == NULL) {
-        LOG_err (FUSE_LOG, "Failed to mount FUSE partition !");
-        return NULL;
-    }
+    // allocate a low-level session, mount options are parsed here
+    hfs_fuse->session = fuse_session_new (&args, &hfs_fuse_opers, sizeof (hfs_fuse_opers), hfs_fuse);
     fuse_opt_free_args (&args);
-
-    // the receive buffer stuff
-    hfs_fuse->recv_size = fuse_chan_bufsize (hfs_fuse->chan);
-
-    // allocate the recv buffer
-    if ((hfs_fuse->recv_buf = g_malloc (hfs_fuse->recv_size)) == NULL) {
-        LOG_err (FUSE_LOG, "failed to malloc memory !");
+    if (!hfs_fuse->session) {
+        LOG_err (FUSE_LOG, "fuse_session_new");
         return NULL;
     }
-    
-    // allocate a low-level session
-    hfs_fuse->session = fuse_lowlevel_new (NULL, &hfs_fuse_opers, sizeof (hfs_fuse_opers), hfs_fuse);
-    if (!hfs_fuse->session) {
-        LOG_err (FUSE_LOG, "fuse_lowlevel_new");
+
+    if (fuse_session_mount (hfs_fuse->session, hfs_fuse->mountpoint) != 0) {
+        LOG_err (FUSE_LOG, "Failed to mount FUSE partition !");
         return NULL;
     }
-    
-    fuse_session_add_chan (hfs_fuse->session, hfs_fuse->chan);
+
+    // buffer is allocated by libfuse on the first request
+    memset (&hfs_fuse->recv_fbuf, 0, sizeof (hfs_fuse->recv_fbuf));
+    hfs_fuse->recv_size = FUSE_MAX_PAGES * getpagesize () + FUSE_HEADER_SIZE;
+
+    // requests are received until device is drained, so it must not block
+    fcntl (fuse_session_fd (hfs_fuse->session), F_SETFL, fcntl (fuse_session_fd (hfs_fuse->session), F_GETFL) | O_NONBLOCK);
+    hfs_fuse->requests_per_wakeup = conf_get_uint (application_get_conf (app), "fuse.requests_per_wakeup");
+    if (!hfs_fuse->requests_per_wakeup)
+        hfs_fuse->requests_per_wakeup = 1;
+
+    hfs_fuse->entry_timeout = conf_get_uint (application_get_conf (app), "fuse.entry_timeout");
+    hfs_fuse->attr_timeout = conf_get_uint (application_get_conf (app), "fuse.attr_timeout");
+    hfs_fuse->negative_timeout = conf_get_uint (application_get_conf (app), "fuse.negative_timeout");
 
     hfs_fuse->ev = event_new (application_get_evbase (app), 
-        fuse_chan_fd (hfs_fuse->chan), EV_READ, &hfs_fuse_on_read, 
+        fuse_session_fd (hfs_fuse->session), EV_READ, &hfs_fuse_on_read, 
         hfs_fuse
     );
     if (!hfs_fuse->ev) {
@@ -144,6 +172,12 @@ HfsFuse *hfs_fuse_new (Application *app, const gchar *mountpoint, const gchar *f
         LOG_err (FUSE_LOG, "event_add");
         return NULL;
     }
+
+    hfs_fuse->inval_pool = g_thread_pool_new (hfs_fuse_inval_worker, hfs_fuse, 1, FALSE, NULL);
+    if (!hfs_fuse->inval_pool) {
+        LOG_err (FUSE_LOG, "Failed to create invalidation thread !");
+        return NULL;
+    }
     /*
     hfs_fuse->ev_timer = evtimer_new (application_get_evbase (app), 
         &hfs_fuse_on_timer, 
@@ -165,9 +199,14 @@ HfsFuse *hfs_fuse_new (Application *app, const gchar *mountpoint, const gchar *f
 
 void hfs_fuse_destroy (HfsFuse *hfs_fuse)
 {
-    fuse_unmount (hfs_fuse->mountpoint, hfs_fuse->chan);
+    // kernel connection is closed first: a running invalidation returns instead of blocking,
+    // then pending invalidations are dropped and the worker is joined before the session is destroyed
+    fuse_session_exit (hfs_fuse->session);
+    fuse_session_unmount (hfs_fuse->session);
+    if (hfs_fuse->inval_pool)
+        g_thread_pool_free (hfs_fuse->inval_pool, TRUE, TRUE);
     g_free (hfs_fuse->mountpoint);
-    g_free (hfs_fuse->recv_buf);
+    free (hfs_fuse->recv_fbuf.mem);
     event_free (hfs_fuse->ev);
     fuse_session_destroy (hfs_fuse->session);
     g_free (hfs_fuse);
@@ -195,45 +234,105 @@ static void hfs_fuse_on_timer (evutil_socket_t fd, short what, void *arg)
 */
 }
 
-// turn ASYNC read off
-static void hfs_fuse_init (G_GNUC_UNUSED void *userdata, struct fuse_conn_info *conn)
+// allow kernel to send concurrent READ requests for the same file, HfsFileOp shares in-flight blocks between them
+// receive requests with splice if kernel supports it: WRITE data stays in a pipe until it's copied to segment buffer
+// send READ replies with splice: data cached on disk goes from cache file to FUSE device without copying
+// always list directories with READDIRPLUS: attributes come with names, no LOOKUP per entry
+// ask for large READ / WRITE requests, a file is copied with fewer requests
+// kernel writeback cache (if enabled) merges small writes into page sized WRITE requests
+static void hfs_fuse_init (void *userdata, struct fuse_conn_info *conn)
 {
-    conn->async_read = 0;
+    HfsFuse *hfs_fuse = (HfsFuse *) userdata;
+    ConfData *conf = application_get_conf (hfs_fuse->app);
+    guint32 max_write;
+
+    if (conn->capable & FUSE_CAP_ASYNC_READ)
+        conn->want |= FUSE_CAP_ASYNC_READ;
+    if (conn->capable & FUSE_CAP_SPLICE_READ)
+        conn->want |= FUSE_CAP_SPLICE_READ;
+    if (conn->capable & FUSE_CAP_SPLICE_WRITE)
+        conn->want |= FUSE_CAP_SPLICE_WRITE;
+    if (conn->capable & FUSE_CAP_READDIRPLUS)
+        conn->want |= FUSE_CAP_READDIRPLUS;
+    conn->want &= ~FUSE_CAP_READDIRPLUS_AUTO;
+
+    // WRITE request must fit into receive buffer
+    max_write = conf_get_uint (conf, "fuse.max_write");
+    if (max_write && max_write < FUSE_MAX_PAGES * getpagesize ())
+        conn->max_write = max_write;
+    else
+        conn->max_write = FUSE_MAX_PAGES * getpagesize ();
+
+    if (conf_get_uint (conf, "fuse.max_readahead"))
+        conn->max_readahead = conf_get_uint (conf, "fuse.max_readahead");
+
+    // kernel resends the last partial page, it must not be uploaded yet:
+    // segments are flushed only at page aligned offsets
+    if (conf_get_boolean (conf, "fuse.writeback_cache") && (conn->capable & FUSE_CAP_WRITEBACK_CACHE)) {
+        if (conf_get_uint (conf, "filesystem.segment_size") % getpagesize ())
+            LOG_err (FUSE_LOG, "Writeback cache is disabled, segment size is not a multiple of page size (%d) !", 
+                getpagesize ());
+        else {
+            LOG_msg (FUSE_LOG, "Writeback cache is enabled, only strictly sequential writes are supported !");
+            conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+        }
+    }
+
+#ifdef FUSE_CAP_PASSTHROUGH
+    // passthrough can't be used together with writeback cache
+    if (conf_get_boolean (conf, "fuse.passthrough") && (conn->capable & FUSE_CAP_PASSTHROUGH) && 
+        !(conn->want & FUSE_CAP_WRITEBACK_CACHE)) {
+        conn->want |= FUSE_CAP_PASSTHROUGH;
+        // backing files are on a regular filesystem
+        conn->max_backing_stack_depth = 1;
+        dir_tree_set_passthrough (hfs_fuse->dir_tree, TRUE);
+    }
+#endif
+
+    LOG_debug (FUSE_LOG, "FUSE connection: max_write: %u, max_readahead: %u, writeback cache: %s", 
+        conn->max_write, conn->max_readahead, conn->want & FUSE_CAP_WRITEBACK_CACHE ? "YES" : "NO");
 }
 
 // low level fuse reading operations
+// drain up to requests_per_wakeup requests from device
 static void hfs_fuse_on_read (evutil_socket_t fd, short what, void *arg)
 {
     HfsFuse *hfs_fuse = (HfsFuse *)arg;
-    struct fuse_chan *ch = hfs_fuse->chan;
+    guint i;
     int res;
 
-    if (!ch) {
-        LOG_err (FUSE_LOG, "No FUSE channel !");
-        return;
-    }
+    for (i = 0; i < hfs_fuse->requests_per_wakeup; i++) {
+        if (fuse_session_exited (hfs_fuse->session)) {
+            LOG_err (FUSE_LOG, "No FUSE session !");
+            return;
+        }
 
-    if (fuse_session_exited (hfs_fuse->session)) {
-        LOG_err (FUSE_LOG, "No FUSE session !");
-        return;
-    }
-    
-    // loop until we complete a recv
-    do {
-        // a new fuse_req is available
-        res = fuse_chan_recv (&ch, hfs_fuse->recv_buf, hfs_fuse->recv_size);
-    } while (res == -EINTR);
+        // loop until we complete a recv
+        do {
+            // a new fuse_req is available
+            res = fuse_session_receive_buf (hfs_fuse->session, &hfs_fuse->recv_fbuf);
+        } while (res == -EINTR);
 
-    if (res == 0)
-        LOG_err (FUSE_LOG, "fuse_chan_recv gave EOF");
+        // device is drained
+        if (res == -EAGAIN)
+            break;
 
-    if (res < 0 && res != -EAGAIN)
-        LOG_err (FUSE_LOG, "fuse_chan_recv failed: %s", strerror(-res));
-    
-    if (res > 0) {
-        // LOG_debug (FUSE_LOG, "got %d bytes from /dev/fuse", res);
+        // request was interrupted
+        if (res == -ENOENT)
+            continue;
+
+        if (res == 0) {
+            LOG_err (FUSE_LOG, "fuse_session_receive_buf gave EOF");
+            break;
+        }
+
+        if (res < 0) {
+            LOG_err (FUSE_LOG, "fuse_session_receive_buf failed: %s", strerror(-res));
+            break;
+        }
 
-        fuse_session_process (hfs_fuse->session, hfs_fuse->recv_buf, res, ch);
+        // LOG_debug (FUSE_LOG, "got %d bytes from /dev/fuse", res);
+        fuse_session_process_buf (hfs_fuse->session, &hfs_fuse->recv_fbuf);
     }
     
     // reschedule
@@ -245,28 +344,96 @@ static void hfs_fuse_on_read (evutil_socket_t fd, short what, void *arg)
 }
 /*}}}*/
 
+/*{{{ kernel cache invalidation */
+
+static void hfs_fuse_inval_worker (gpointer data, gpointer user_data)
+{
+    HfsFuseInval *inval = (HfsFuseInval *) data;
+    HfsFuse *hfs_fuse = (HfsFuse *) user_data;
+    int res;
+
+    if (inval->name)
+        res = fuse_lowlevel_notify_inval_entry (hfs_fuse->session, inval->ino, inval->name, strlen (inval->name));
+    else
+        res = fuse_lowlevel_notify_inval_inode (hfs_fuse->session, inval->ino, 0, 0);
+
+    // -ENOENT: kernel does not know this inode / entry, nothing to invalidate
+    if (res && res != -ENOENT)
+        LOG_err (FUSE_LOG, "Failed to invalidate kernel cache for ino: %"INO_FMT" (%s): %s",
+            inval->ino, inval->name ? inval->name : "data", strerror (-res));
+    else
+        LOG_debug (FUSE_LOG, "Invalidated kernel cache for ino: %"INO_FMT" (%s)",
+            inval->ino, inval->name ? inval->name : "data");
+
+    g_free (inval->name);
+    g_free (inval);
+}
+
+static void hfs_fuse_inval_push (HfsFuse *hfs_fuse, fuse_ino_t ino, const gchar *name)
+{
+    HfsFuseInval *inval;
+
+    inval = g_new0 (HfsFuseInval, 1);
+    inval->ino = ino;
+    inval->name = g_strdup (name);
+
+    g_thread_pool_push (hfs_fuse->inval_pool, inval, NULL);
+}
+
+// object was changed: drop cached pages and attributes of the inode
+void hfs_fuse_notify_inval_inode (HfsFuse *hfs_fuse, fuse_ino_t ino)
+{
+    hfs_fuse_inval_push (hfs_fuse, ino, NULL);
+}
+
+// object was removed: drop kernel's name -> inode mapping
+void hfs_fuse_notify_inval_entry (HfsFuse *hfs_fuse, fuse_ino_t parent_ino, const gchar *name)
+{
+    hfs_fuse_inval_push (hfs_fuse, parent_ino, name);
+}
+/*}}}*/
+
 /*{{{ readdir operation */
 
 #define min(x, y) ((x) < (y) ? (x) : (y))
 
 // return newly allocated buffer which holds directory entry
-void hfs_fuse_add_dirbuf (fuse_req_t req, struct dirbuf *b, const char *name, fuse_ino_t ino, off_t file_size)
+// READDIRPLUS ("plus") entry also carries attributes, kernel sends LOOKUP for it only if "attr_valid" is FALSE
+void hfs_fuse_add_dirbuf (fuse_req_t req, struct dirbuf *b, gboolean plus, const char *name, 
+    fuse_ino_t ino, int mode, off_t file_size, time_t ctime, gboolean attr_valid)
 {
-    struct stat stbuf;
+    HfsFuse *hfs_fuse = fuse_req_userdata (req);
+    struct fuse_entry_param e;
     size_t oldsize = b->size;
     
     LOG_debug (FUSE_LOG, "add_dirbuf  ino: %d, name: %s", ino, name);
 
     // get required buff size
-	b->size += fuse_add_direntry (req, NULL, 0, name, NULL, 0);
+    if (plus)
+        b->size += fuse_add_direntry_plus (req, NULL, 0, name, NULL, 0);
+    else
+	    b->size += fuse_add_direntry (req, NULL, 0, name, NULL, 0);
 
     // extend buffer
 	b->p = (char *) g_realloc (b->p, b->size);
-	memset (&stbuf, 0, sizeof (stbuf));
-	stbuf.st_ino = ino;
-    stbuf.st_size = file_size;
+	memset (&e, 0, sizeof (e));
+	e.attr.st_ino = ino;
+    e.attr.st_mode = mode;
+    e.attr.st_nlink = S_ISDIR (mode) ? 2 : 1;
+    e.attr.st_size = file_size;
+    e.attr.st_ctime = ctime;
+    e.attr.st_atime = ctime;
+    e.attr.st_mtime = ctime;
+
     // add entry
-	fuse_add_direntry (req, b->p + oldsize, b->size - oldsize, name, &stbuf, b->size);
+    if (plus) {
+        // zero inode: entry is listed without attributes
+        e.ino = attr_valid ? ino : 0;
+        e.attr_timeout = hfs_fuse->attr_timeout;
+        e.entry_timeout = hfs_fuse->entry_timeout;
+        fuse_add_direntry_plus (req, b->p + oldsize, b->size - oldsize, name, &e, b->size);
+    } else
+	    fuse_add_direntry (req, b->p + oldsize, b->size - oldsize, name, &e.attr, b->size);
 }
 
 // readdir callback
@@ -295,7 +462,20 @@ static void hfs_fuse_readdir (fuse_req_t req, fuse_ino_t ino, size_t size, off_t
     LOG_debug (FUSE_LOG, "readdir  inode: %"INO_FMT", size: %zd, off: %"OFF_FMT, ino, size, off);
     
     // fill directory buffer for "ino" directory
-    dir_tree_fill_dir_buf (hfs_fuse->dir_tree, ino, size, off, hfs_fuse_readdir_cb, req);
+    dir_tree_fill_dir_buf (hfs_fuse->dir_tree, ino, size, off, FALSE, hfs_fuse_readdir_cb, req);
+}
+
+// FUSE lowlevel operation: readdirplus
+// the same as readdir, but entries carry attributes: "ls -l" doesn't need LOOKUP / GETATTR per entry
+// Valid replies: fuse_reply_buf() fuse_reply_err()
+static void hfs_fuse_readdirplus (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    HfsFuse *hfs_fuse = fuse_req_userdata (req);
+
+    LOG_debug (FUSE_LOG, "readdirplus  inode: %"INO_FMT", size: %zd, off: %"OFF_FMT, ino, size, off);
+    
+    // fill directory buffer for "ino" directory
+    dir_tree_fill_dir_buf (hfs_fuse->dir_tree, ino, size, off, TRUE, hfs_fuse_readdir_cb, req);
 }
 /*}}}*/
 
@@ -304,6 +484,7 @@ static void hfs_fuse_readdir (fuse_req_t req, fuse_ino_t ino, size_t size, off_t
 // getattr callback
 static void hfs_fuse_getattr_cb (fuse_req_t req, gboolean success, fuse_ino_t ino, int mode, off_t file_size, time_t ctime)
 {
+    HfsFuse *hfs_fuse = fuse_req_userdata (req);
     struct stat stbuf;
 
     LOG_debug (FUSE_LOG, "getattr_cb  success: %s", success?"YES":"NO");
@@ -320,7 +501,7 @@ static void hfs_fuse_getattr_cb (fuse_req_t req, gboolean success, fuse_ino_t in
     stbuf.st_atime = ctime;
     stbuf.st_mtime = ctime;
     
-    fuse_reply_attr (req, &stbuf, 1.0);
+    fuse_reply_attr (req, &stbuf, hfs_fuse->attr_timeout);
 }
 
 // FUSE lowlevel operation: getattr
@@ -339,6 +520,7 @@ static void hfs_fuse_getattr (fuse_req_t req, fuse_ino_t ino, struct fuse_file_i
 // setattr callback
 static void hfs_fuse_setattr_cb (fuse_req_t req, gboolean success, fuse_ino_t ino, int mode, off_t file_size)
 {
+    HfsFuse *hfs_fuse = fuse_req_userdata (req);
     struct stat stbuf;
 
     LOG_debug (FUSE_LOG, "setattr_cb  success: %s", success?"YES":"NO");
@@ -352,7 +534,7 @@ static void hfs_fuse_setattr_cb (fuse_req_t req, gboolean success, fuse_ino_t in
 	stbuf.st_nlink = 1;
 	stbuf.st_size = file_size;
     
-    fuse_reply_attr (req, &stbuf, 1.0);
+    fuse_reply_attr (req, &stbuf, hfs_fuse->attr_timeout);
 }
 
 // FUSE lowlevel operation: setattr
@@ -368,20 +550,35 @@ static void hfs_fuse_setattr (fuse_req_t req, fuse_ino_t ino, struct stat *attr,
 /*{{{ lookup operation*/
 
 // lookup callback
-static void hfs_fuse_lookup_cb (fuse_req_t req, gboolean success, fuse_ino_t ino, int mode, off_t file_size, time_t ctime)
+static void hfs_fuse_lookup_cb (fuse_req_t req, gboolean success, gboolean not_found, fuse_ino_t ino, int mode, off_t file_size, time_t ctime)
 {
+    HfsFuse *hfs_fuse = fuse_req_userdata (req);
 	struct fuse_entry_param e;
 
     LOG_debug (FUSE_LOG, "lookup_cb  success: %s", success?"YES":"NO");
+
+    memset(&e, 0, sizeof(e));
+
     if (!success) {
-		fuse_reply_err (req, ENOENT);
+        // transient failure (server error, no connection): don't let kernel cache it
+        if (!not_found) {
+            fuse_reply_err (req, EIO);
+            return;
+        }
+
+        // zero inode: kernel caches the missing name for "negative_timeout" seconds
+        if (hfs_fuse->negative_timeout > 0) {
+            e.ino = 0;
+            e.entry_timeout = hfs_fuse->negative_timeout;
+            fuse_reply_entry (req, &e);
+        } else
+		    fuse_reply_err (req, ENOENT);
         return;
     }
 
-    memset(&e, 0, sizeof(e));
     e.ino = ino;
-    e.attr_timeout = 1.0;
-    e.entry_timeout = 1.0;
+    e.attr_timeout = hfs_fuse->attr_timeout;
+    e.entry_timeout = hfs_fuse->entry_timeout;
 
     e.attr.st_ino = ino;
     e.attr.st_mode = mode;
@@ -432,6 +629,7 @@ static void hfs_fuse_open (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 // create callback
 void hfs_fuse_create_cb (fuse_req_t req, gboolean success, fuse_ino_t ino, int mode, off_t file_size, struct fuse_file_info *fi)
 {
+    HfsFuse *hfs_fuse = fuse_req_userdata (req);
 	struct fuse_entry_param e;
 
     LOG_debug (FUSE_LOG, "add_file_cb  success: %s", success?"YES":"NO");
@@ -442,8 +640,8 @@ void hfs_fuse_create_cb (fuse_req_t req, gboolean success, fuse_ino_t ino, int m
 
     memset(&e, 0, sizeof(e));
     e.ino = ino;
-    e.attr_timeout = 1.0;
-    e.entry_timeout = 1.0;
+    e.attr_timeout = hfs_fuse->attr_timeout;
+    e.entry_timeout = hfs_fuse->entry_timeout;
 
     e.attr.st_ino = ino;
     e.attr.st_mode = mode;
@@ -475,7 +673,7 @@ static void hfs_fuse_release (fuse_req_t req, fuse_ino_t ino, struct fuse_file_i
 
     LOG_debug (FUSE_LOG, "release  inode: %d, flags: %d", ino, fi->flags);
 
-    dir_tree_file_release (hfs_fuse->dir_tree, ino, fi);
+    dir_tree_file_release (hfs_fuse->dir_tree, ino, fi, req);
 
     fuse_reply_err (req, 0);
 }
@@ -484,17 +682,18 @@ static void hfs_fuse_release (fuse_req_t req, fuse_ino_t ino, struct fuse_file_i
 /*{{{ read operation */
 
 // read callback
-static void hfs_fuse_read_cb (fuse_req_t req, gboolean success, const char *buf, size_t buf_size)
+// data is copied from memory, or spliced from cache file descriptor
+static void hfs_fuse_read_cb (fuse_req_t req, gboolean success, struct fuse_bufvec *bufv)
 {
 
-    LOG_debug (FUSE_LOG, "[%p] <<<<< read_cb  success: %s IN buf: %zu", req, success?"YES":"NO", buf_size);
+    LOG_debug (FUSE_LOG, "[%p] <<<<< read_cb  success: %s IN buf: %zu", req, success?"YES":"NO", success ? fuse_buf_size (bufv) : 0);
 
     if (!success) {
-		fuse_reply_err (req, ENOENT);
+		fuse_reply_err (req, fuse_req_interrupted (req) ? EINTR : ENOENT);
         return;
     }
 
-	fuse_reply_buf (req, buf, buf_size);
+	fuse_reply_data (req, bufv, 0);
 }
 
 // FUSE lowlevel operation: read
@@ -522,15 +721,16 @@ static void hfs_fuse_write_cb (fuse_req_t req, gboolean success, size_t count)
     
     fuse_reply_write (req, count);
 }
-// FUSE lowlevel operation: write
+// FUSE lowlevel operation: write_buf
+// data is either in memory or in a pipe if request was received with splice
 // Valid replies: fuse_reply_write() fuse_reply_err()
-static void hfs_fuse_write (fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
+static void hfs_fuse_write_buf (fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv, off_t off, struct fuse_file_info *fi)
 {
     HfsFuse *hfs_fuse = fuse_req_userdata (req);
     
-    // LOG_debug (FUSE_LOG, "write  inode: %"INO_FMT", size: %zd, off: %"OFF_FMT, ino, size, off);
+    // LOG_debug (FUSE_LOG, "write  inode: %"INO_FMT", size: %zd, off: %"OFF_FMT, ino, fuse_buf_size (bufv), off);
 
-    dir_tree_file_write (hfs_fuse->dir_tree, ino, buf, size, off, hfs_fuse_write_cb, req, fi);
+    dir_tree_file_write (hfs_fuse->dir_tree, ino, bufv, off, hfs_fuse_write_cb, req, fi);
 }
 /*}}}*/
 
@@ -548,11 +748,11 @@ static void hfs_fuse_forget_cb (fuse_req_t req, gboolean success)
 // Forget about an inode
 // Valid replies: fuse_reply_none
 // XXX: it removes files and directories
-static void hfs_fuse_forget (fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+static void hfs_fuse_forget (fuse_req_t req, fuse_ino_t ino, uint64_t nlookup)
 {
     HfsFuse *hfs_fuse = fuse_req_userdata (req);
     
-    LOG_debug (FUSE_LOG, "forget  inode: %"INO_FMT", nlookup: %lu", ino, nlookup);
+    LOG_debug (FUSE_LOG, "forget  inode: %"INO_FMT", nlookup: %"G_GUINT64_FORMAT, ino, nlookup);
     
     if (nlookup != 0) {
         LOG_debug (FUSE_LOG, "Ignoring forget with nlookup > 0");
@@ -592,6 +792,7 @@ static void hfs_fuse_unlink (fuse_req_t req, fuse_ino_t parent, const char *name
 // mkdir callback
 static void hfs_fuse_mkdir_cb (fuse_req_t req, gboolean success, fuse_ino_t ino, int mode, off_t file_size, time_t ctime)
 {
+    HfsFuse *hfs_fuse = fuse_req_userdata (req);
 	struct fuse_entry_param e;
 
     LOG_debug (FUSE_LOG, "mkdir_cb  success: %s, ino: %"INO_FMT, success?"YES":"NO", ino);
@@ -602,8 +803,8 @@ static void hfs_fuse_mkdir_cb (fuse_req_t req, gboolean success, fuse_ino_t ino,
 
     memset(&e, 0, sizeof(e));
 	e.ino = ino;
-	e.attr_timeout = 1.0;
-	e.entry_timeout = 1.0;
+	e.attr_timeout = hfs_fuse->attr_timeout;
+	e.entry_timeout = hfs_fuse->entry_timeout;
     //e.attr.st_mode = S_IFDIR | 0755;
     e.attr.st_mode = mode;
 	e.attr.st_nlink = 2;
@@ -15,135 +15,222 @@
 */
 #include "hfs_range.h"
 
-struct _HfsRange {
-    GList *l_intervals; // sorted list of intervals
-};
+// intervals are stored in a skip list, sorted by start position
+// intervals never overlap or touch each other: they are merged on add
+
+#define RANGE_MAX_LEVEL 16
 
-typedef struct {
+typedef struct _Interval Interval;
+struct _Interval {
     guint64 start;
     guint64 end;
-} Interval;
+    gint level; // number of forward links
+    Interval *next[1]; // forward links, "level" items
+};
+
+struct _HfsRange {
+    Interval *head; // not an interval, holds forward links for each level
+    gint level; // current max level
+    gint count; // number of intervals
+    guint64 length; // total length of all intervals
+    guint32 seed; // random level generator state
+};
+
+static Interval *interval_create (gint level, guint64 start, guint64 end)
+{
+    Interval *in;
+
+    in = g_malloc0 (sizeof (Interval) + (level - 1) * sizeof (Interval *));
+    in->level = level;
+    in->start = start;
+    in->end = end;
+
+    return in;
+}
 
 HfsRange *hfs_range_create ()
 {
     HfsRange *range;
 
     range = g_new0 (HfsRange, 1);
-    range->l_intervals = NULL;
+    range->head = interval_create (RANGE_MAX_LEVEL, 0, 0);
+    range->level = 1;
+    range->count = 0;
+    range->length = 0;
+    range->seed = 2463534242U;
 
     return range;
 }
 
 void hfs_range_destroy (HfsRange *range)
 {
-    GList *l;
+    Interval *in, *next;
 
-    for (l = g_list_first (range->l_intervals); l; l = g_list_next (l)) {
-        Interval *in = (Interval *) l->data;
+    for (in = range->head; in; in = next) {
+        next = in->next[0];
         g_free (in);
     }
-    g_list_free (range->l_intervals);
     g_free (range);
 }
 
-static gint intervals_compare (Interval *a, Interval *b)
+// each level has 1/4 of intervals of the previous level
+static gint hfs_range_random_level (HfsRange *range)
+{
+    gint level = 1;
+
+    // xorshift32
+    range->seed ^= range->seed << 13;
+    range->seed ^= range->seed >> 17;
+    range->seed ^= range->seed << 5;
+
+    while (level < RANGE_MAX_LEVEL && ((range->seed >> (level * 2)) & 3) == 0)
+        level++;
+
+    return level;
+}
+
+// fill "update" with the last intervals on each level, which start before "pos"
+// return the last interval which starts before or at "pos" (range->head if none)
+static Interval *hfs_range_find (HfsRange *range, guint64 pos, Interval **update)
 {
-    if (a->start < b->start)
-        return -1;
-    else if (a->start > b->start)
-        return 1;
-    else 
-        return 0;
+    Interval *in = range->head;
+    gint i;
+
+    for (i = range->level - 1; i >= 0; i--) {
+        while (in->next[i] && in->next[i]->start < pos)
+            in = in->next[i];
+        if (update)
+            update[i] = in;
+    }
+
+    if (in->next[0] && in->next[0]->start == pos)
+        return in->next[0];
+
+    return in;
 }
 
 void hfs_range_add (HfsRange *range, guint64 start, guint64 end)
 {
-    GList *l;
-    gboolean found = FALSE;
+    Interval *update[RANGE_MAX_LEVEL];
+    Interval *in;
+    gint level, i;
 
-    l = g_list_first (range->l_intervals);
-    while (l) {
-        Interval *in = (Interval *) l->data;
-        
+    if (start >= end)
+        return;
+
+    // previous interval overlaps or touches the new one, extend it instead
+    in = hfs_range_find (range, start, update);
+    if (in != range->head && in->end >= start) {
         // is in range
-        if (in->start <= start && in->end >= end) {
+        if (in->end >= end)
             return;
-        }
+        start = in->start;
+        hfs_range_find (range, start, update);
+    }
 
-        // overlaps
-        if ((in->start >= start && in->start <= end) || (in->end >= start && in->end <= end)) {
-            GList *j;
-            found = TRUE;
-            // extend it
-            if (in->end < end)
-                in->end = end;
-            if (in->start > start)
-                in->start = start;
-
-            
-            j = l->next;
-            while (j) {
-                // extend
-                Interval *in1 = (Interval *) j->data;
-                if ((in->start >= in1->start && in->start <= in1->end) || 
-                    (in->end >= in1->start && in->end <= in1->end) || 
-                    (in->start <= in1->start && in->end >= in1->end)) {
-                    GList *l_save;
-
-                    if (in->end < in1->end)
-                        in->end = in1->end;
-                    if (in->start > in1->start)
-                        in->start = in1->start;
-
-                    l_save = j->next;
-                    range->l_intervals = g_list_delete_link (range->l_intervals, j);
-                    j = l_save;
-
-                    g_free (in1);
-                } else 
-                    j = j->next;
-            }
-        }
+    // remove all intervals which overlap or touch [start, end]
+    while ((in = update[0]->next[0]) && in->start <= end) {
+        if (in->end > end)
+            end = in->end;
+
+        for (i = 0; i < in->level; i++)
+            update[i]->next[i] = in->next[i];
 
-        l = l->next;
+        range->count--;
+        range->length -= in->end - in->start;
+        g_free (in);
     }
 
-    // not found
-    if (!found) {
-        Interval *in = g_new0 (Interval, 1);
-        in->start = start;
-        in->end = end;
-        range->l_intervals = g_list_insert_sorted (range->l_intervals, in, (GCompareFunc) intervals_compare);
+    while (range->level > 1 && !range->head->next[range->level - 1])
+        range->level--;
+
+    // insert merged interval
+    level = hfs_range_random_level (range);
+    if (level > range->level) {
+        for (i = range->level; i < level; i++)
+            update[i] = range->head;
+        range->level = level;
+    }
+
+    in = interval_create (level, start, end);
+    for (i = 0; i < level; i++) {
+        in->next[i] = update[i]->next[i];
+        update[i]->next[i] = in;
     }
+
+    range->count++;
+    range->length += end - start;
 }
 
 gboolean hfs_range_contain (HfsRange *range, guint64 start, guint64 end)
 {
-    GList *l;
+    Interval *in;
 
-    for (l = g_list_first (range->l_intervals); l; l = g_list_next (l)) {
-        Interval *in = (Interval *) l->data;
+    in = hfs_range_find (range, start, NULL);
+    if (in == range->head)
+        return FALSE;
 
-        if (in->start <= start && in->end >= end)
-            return TRUE;
+    return in->start <= start && in->end >= end;
+}
+
+// return list of HfsRangeSegment, covered and missing parts of [start, end)
+GList *hfs_range_query (HfsRange *range, guint64 start, guint64 end)
+{
+    GList *l_segments = NULL;
+    HfsRangeSegment *seg;
+    Interval *in;
+    guint64 pos = start;
+
+    in = hfs_range_find (range, start, NULL);
+    if (in == range->head || in->end <= start)
+        in = in->next[0];
+
+    for (; in && in->start < end && pos < end; in = in->next[0]) {
+        if (in->start > pos) {
+            seg = g_new0 (HfsRangeSegment, 1);
+            seg->start = pos;
+            seg->end = in->start;
+            seg->covered = FALSE;
+            l_segments = g_list_prepend (l_segments, seg);
+            pos = in->start;
+        }
+
+        seg = g_new0 (HfsRangeSegment, 1);
+        seg->start = pos;
+        seg->end = MIN (in->end, end);
+        seg->covered = TRUE;
+        l_segments = g_list_prepend (l_segments, seg);
+        pos = seg->end;
+    }
+
+    if (pos < end) {
+        seg = g_new0 (HfsRangeSegment, 1);
+        seg->start = pos;
+        seg->end = end;
+        seg->covered = FALSE;
+        l_segments = g_list_prepend (l_segments, seg);
     }
 
-    return FALSE;
+    return g_list_reverse (l_segments);
 }
 
 gint hfs_range_count (HfsRange *range)
 {
-    return g_list_length (range->l_intervals);
+    return range->count;
+}
+
+// return total length of all intervals
+guint64 hfs_range_length (HfsRange *range)
+{
+    return range->length;
 }
 
 void hfs_range_print (HfsRange *range)
 {
-    GList *l;
+    Interval *in;
 
     g_printf ("===\n");
-    for (l = g_list_first (range->l_intervals); l; l = g_list_next (l)) {
-        Interval *in = (Interval *) l->data;
-        g_printf ("[%lu %lu]\n", in->start, in->end);
+    for (in = range->head->next[0]; in; in = in->next[0]) {
+        g_printf ("[%"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT"]\n", in->start, in->end);
     }
 }
-
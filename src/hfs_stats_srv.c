@@ -40,6 +40,8 @@ struct _HfsStatsSrv {
     guint64 storage_server_requests;
 
     GQueue *q_history; // queue of HistoryItem
+
+    HfsCacheStats cache_stats;
 };
 
 typedef struct {
@@ -214,6 +216,35 @@ static void hfs_stats_srv_on_stats_cb (struct evhttp_request *req, void *arg)
         );
     }
 
+    {
+        HfsCacheStats stats = srv->cache_stats;
+        gchar cache_size[30];
+        guint64 mem_requests, disk_requests;
+
+        // memory tier sees all requests, disk tier - only memory tier misses
+        disk_requests = stats.cache_hits + stats.cache_miss;
+        mem_requests = stats.mem_hits + disk_requests;
+
+        strcpy (cache_size, bytes_get_string (stats.size));
+        evbuffer_add_printf (evb, 
+            "<BR>Cache size: %s / %s Objects: %u <BR>"
+            "Cache hits: %"G_GUINT64_FORMAT" (%.1f%%) Misses: %"G_GUINT64_FORMAT" <BR>"
+            "Cache admissions: %"G_GUINT64_FORMAT" Evictions: %"G_GUINT64_FORMAT" (%s)",
+            cache_size, bytes_get_string (stats.max_size), stats.entries,
+            stats.cache_hits, disk_requests ? 100.0 * stats.cache_hits / disk_requests : 0.0, stats.cache_miss,
+            stats.admissions, stats.evictions, bytes_get_string (stats.evicted_bytes)
+        );
+
+        strcpy (cache_size, bytes_get_string (stats.mem_size));
+        evbuffer_add_printf (evb, 
+            "<BR>Memory cache size: %s / %s Blocks: %u <BR>"
+            "Memory cache hits: %"G_GUINT64_FORMAT" (%.1f%%) Promotions: %"G_GUINT64_FORMAT" Demotions: %"G_GUINT64_FORMAT,
+            cache_size, bytes_get_string (stats.mem_max_size), stats.mem_blocks,
+            stats.mem_hits, mem_requests ? 100.0 * stats.mem_hits / mem_requests : 0.0,
+            stats.mem_promotions, stats.mem_demotions
+        );
+    }
+
     {
         GList *l_tasks = NULL, *l;
 
@@ -351,6 +382,11 @@ void hfs_stats_srv_set_storage_srv_status (HfsStatsSrv *srv, gint code, const gc
     }
 }
 
+void hfs_stats_srv_set_cache_stats (HfsStatsSrv *srv, HfsCacheStats *stats)
+{
+    srv->cache_stats = *stats;
+}
+
 static void history_item_destroy (HistoryItem *item)
 {
     g_free (item->url);
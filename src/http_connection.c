@@ -217,9 +217,33 @@ struct evhttp_connection *http_connection_get_evcon (HttpConnection *con)
 typedef struct {
     HttpConnection *con;
     HttpConnection_response_cb response_cb;
+    HttpConnection_chunk_cb chunk_cb;
     gpointer ctx;
 } RequestData;
 
+// a part of response body is received
+static void http_connection_on_chunk_cb (struct evhttp_request *req, void *ctx)
+{
+    RequestData *data = (RequestData *) ctx;
+    struct evbuffer *inbuf;
+    size_t buf_len;
+    int code = evhttp_request_get_response_code (req);
+
+    // error is reported by response callback
+    if (code < 200 || code >= 300)
+        return;
+
+    inbuf = evhttp_request_get_input_buffer (req);
+    buf_len = evbuffer_get_length (inbuf);
+    if (!buf_len)
+        return;
+
+    hfs_stats_srv_add_down_bytes (data->con->stats_srv, buf_len);
+
+    // libevent drains input buffer after callback
+    data->chunk_cb (data->con, data->ctx, (const gchar *) evbuffer_pullup (inbuf, buf_len), buf_len);
+}
+
 static void http_connection_on_response_cb (struct evhttp_request *req, void *ctx)
 {
     RequestData *data = (RequestData *) ctx;
@@ -234,6 +258,11 @@ static void http_connection_on_response_cb (struct evhttp_request *req, void *ct
     timeval_zero (&data->con->start_tv);
 
     LOG_debug (CON_LOG, "[%p] Request cb !", data->con);
+
+    // request is completed, response callback can send a new one
+    data->con->current_req = NULL;
+    data->con->current_req_data = NULL;
+    data->con->response_code = req ? evhttp_request_get_response_code (req) : 0;
     
     if (!req) {
         LOG_err (CON_LOG, "[%p] Request failed !", data->con);
@@ -251,9 +280,10 @@ static void http_connection_on_response_cb (struct evhttp_request *req, void *ct
     data->con->upload_bytes = 0;
 
     // XXX: handle redirect
-    // 200 (Ok), 201 (Created), 202 (Accepted), 204 (No Content) are ok
+    // 200 (Ok), 201 (Created), 202 (Accepted), 204 (No Content), 206 (Partial Content) are ok
     if (evhttp_request_get_response_code (req) != 200 && evhttp_request_get_response_code (req) != 204 &&
-            evhttp_request_get_response_code (req) != 202 && evhttp_request_get_response_code (req) != 201) {
+            evhttp_request_get_response_code (req) != 202 && evhttp_request_get_response_code (req) != 201 &&
+            evhttp_request_get_response_code (req) != 206) {
         LOG_err (CON_LOG, "Server returned HTTP error: %d !", evhttp_request_get_response_code (req));
         LOG_debug (CON_LOG, "[%p] Error str: %s", data->con, req->response_code_line);
         if (data->response_cb)
@@ -282,6 +312,12 @@ done:
     g_free (data);
 }
 
+// pass response body of the next request to "chunk_cb" as it arrives
+void http_connection_set_chunk_cb (HttpConnection *con, HttpConnection_chunk_cb chunk_cb)
+{
+    con->chunk_cb = (gpointer) chunk_cb;
+}
+
 // add an header to the outgoing request
 void http_connection_add_output_header (HttpConnection *con, const gchar *key, const gchar *value)
 {
@@ -323,6 +359,10 @@ gboolean http_connection_make_request_ (HttpConnection *con,
     struct evhttp_uri *uri;
     gchar *req_uri;
     GList *l;
+    HttpConnection_chunk_cb chunk_cb = (HttpConnection_chunk_cb) con->chunk_cb;
+
+    // body callback is set for this request only
+    con->chunk_cb = NULL;
 
     // connect
     if (!con->evcon) {
@@ -345,6 +385,7 @@ gboolean http_connection_make_request_ (HttpConnection *con,
     data->response_cb = response_cb;
     data->ctx = ctx;
     data->con = con;
+    data->chunk_cb = chunk_cb;
     
     if (!strcasecmp (http_cmd, "GET")) {
         cmd_type = EVHTTP_REQ_GET;
@@ -368,6 +409,9 @@ gboolean http_connection_make_request_ (HttpConnection *con,
         return FALSE;
     }
 
+    if (data->chunk_cb)
+        evhttp_request_set_chunked_cb (req, http_connection_on_chunk_cb);
+
     evhttp_add_header (req->output_headers, "X-Auth-Token", con->auth_token);
     evhttp_add_header (req->output_headers, "Host", evhttp_uri_get_host (uri));
     evhttp_add_header (req->output_headers, "Accept-Encoding", "identify");
@@ -411,8 +455,11 @@ gboolean http_connection_make_request_ (HttpConnection *con,
     if (res < 0) {
         LOG_err (CON_LOG, "Failed to create request !");
         return FALSE;
-    } else
+    } else {
+        con->current_req = req;
+        con->current_req_data = data;
         return TRUE;
+    }
 }
 
 typedef struct {
@@ -422,6 +469,7 @@ typedef struct {
     struct evbuffer *out_buffer;
     HttpConnection_response_cb response_cb;
     gpointer ctx;
+    gboolean cancelled; // request was cancelled while waiting for AuthData
 } ARequest;
 
 // on AuthServer reply
@@ -431,11 +479,16 @@ static void http_connection_on_auth_data_cb (gpointer ctx, gboolean success,
     ARequest *req = (ARequest *) ctx;
     gchar *url;
 
-    if (!success) {
+    if (req->cancelled) {
+        LOG_debug (CON_LOG, "Request was cancelled: %s %s", req->http_cmd, req->resource_path);
+    } else if (!success) {
+        req->con->pending_req = NULL;
+        req->con->chunk_cb = NULL;
         LOG_err (CON_LOG, "Failed to get AuthToken !");
         // inform higher level
         req->response_cb (req->con, req->ctx, NULL, 0, NULL, FALSE);
     } else {
+        req->con->pending_req = NULL;
         url = g_strdup_printf ("%s%s", storage_uri, req->resource_path);
         if (req->con->auth_token)
             g_free (req->con->auth_token);
@@ -474,7 +527,38 @@ gboolean http_connection_make_request_to_storage_url (HttpConnection *con,
         g_free (con->s_status);
     con->s_status = g_strdup_printf ("%s %s", http_cmd, resource_path);
 
+    con->pending_req = req;
     auth_client_get_data (application_get_auth_client (con->app), FALSE, http_connection_on_auth_data_cb, req);
     return TRUE;
 
 }
+
+// cancel request in progress, its response callback is not called
+void http_connection_cancel_request (HttpConnection *con)
+{
+    // AuthData is not received yet, request is not sent
+    if (con->pending_req) {
+        ARequest *req = (ARequest *) con->pending_req;
+
+        LOG_debug (CON_LOG, "[%p] Cancelling request: %s %s", con, req->http_cmd, req->resource_path);
+        req->cancelled = TRUE;
+        con->pending_req = NULL;
+    }
+
+    // libevent resets connection if response is being received,
+    // request callback is not called and request is freed
+    if (con->current_req) {
+        LOG_debug (CON_LOG, "[%p] Cancelling request: %s", con, con->s_status);
+        evhttp_cancel_request (con->current_req);
+        g_free (con->current_req_data);
+        con->current_req = NULL;
+        con->current_req_data = NULL;
+    }
+    con->chunk_cb = NULL;
+
+    if (con->s_status)
+        g_free (con->s_status);
+    con->s_status = g_strdup (IDLE);
+    timeval_zero (&con->start_tv);
+    con->upload_bytes = 0;
+}
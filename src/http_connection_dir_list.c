@@ -15,131 +15,235 @@
 */
 #include "http_connection.h"
 #include "dir_tree.h"
+#include "hfs_dir_list_parser.h"
 
+// directory listing, large directories are split into key ranges (partitions) listed in parallel
 typedef struct {
+    DirTree *dir_tree;
+    fuse_ino_t ino;
+    guint64 age; // listing generation of directory
+    guint parts_left; // number of partitions being listed, +1 while partitions are started
+    gboolean success;
+    HttpConnection_directory_listing_callback directory_listing_callback;
+    gpointer callback_data;
+} DirListJob;
+
+// listing of a partition
+typedef struct {
+    DirListJob *job;
     Application *app;
     DirTree *dir_tree;
     HttpConnection *con;
     gchar *dir_path;
     fuse_ino_t ino;
-    gint max_keys;
-    HttpConnection_directory_listing_callback directory_listing_callback;
-    gpointer callback_data;
+    guint page_size; // max number of entries in a listing page
+    gchar *start_marker; // partition contains names after start_marker, NULL for the first partition
+    gchar *end_marker; // partition contains names before end_marker, NULL for the last partition
+
+    HfsDirListFormat format; // "filesystem.dir_list_format"
+
+    // listing page is parsed as it arrives, entries are added to DirTree one by one
+    HfsDirListParser *parser; // parser of the current page
+    guint page_entries; // number of entries parsed in the current page
+    gchar *last_name; // full name of the last parsed entry
 } DirListRequest;
 
 #define CON_DIR_LOG "con_dir"
+// MD5 of empty content
+#define EMPTY_MD5 "d41d8cd98f00b204e9800998ecf8427e"
+
+static void http_connection_on_directory_listing_data (HttpConnection *con, void *ctx, 
+    const gchar *buf, size_t buf_len, 
+    G_GNUC_UNUSED struct evkeyvalq *headers, gboolean success);
 
-// parses  directory XML 
-// reutrns TRUE if ok
-static gboolean parse_dir_xml (DirListRequest *dir_list, const char *xml, size_t xml_len)
+/*{{{ listing parser */
+
+// add parsed entry to DirTree
+static void dir_req_on_entry_cb (gpointer ctx, const HfsDirListEntry *entry)
 {
-    xmlNode *onode = NULL, *anode = NULL, *text_node = NULL;
-    xmlParserCtxtPtr xmlctx;
-    //struct tm last_modified;
+    DirListRequest *dir_req = (DirListRequest *) ctx;
     gchar *name;
-    time_t last_modified = time (NULL);
-    xmlNode *root_element;
 
-    xmlctx = xmlCreatePushParserCtxt (NULL, NULL, "", 0, NULL);
-    xmlParseChunk (xmlctx, (char *)xml, xml_len, 0);
-    xmlParseChunk (xmlctx, "", 0, 1);
+    dir_req->page_entries++;
+    g_free (dir_req->last_name);
+    dir_req->last_name = g_strdup (entry->name);
 
-    xmlParseChunk (xmlctx, "", 0, 1);
+    name = g_path_get_basename (entry->name);
 
-    if (!xmlctx->wellFormed) {
-        LOG_err (CON_DIR_LOG, "Failed to parse directory !");
-        return FALSE;
+    // directory: subdir or directory marker object
+    if (entry->is_subdir || (entry->content_type && !strcmp (entry->content_type, "application/directory"))) {
+        LOG_debug (CON_DIR_LOG, ">> got dir entry: %s", name);
+        dir_tree_update_entry (dir_req->dir_tree, dir_req->dir_path, DET_dir, dir_req->ino, name, 0, 
+            entry->last_modified, NULL);
+    // file
+    } else {
+        const gchar *etag = entry->hash;
+
+        // hash of segmented object's manifest is MD5 of its empty body, it doesn't change when segments are
+        // rewritten: object version is known only from HEAD response
+        if (!entry->bytes && etag && !strcmp (etag, EMPTY_MD5))
+            etag = NULL;
+
+        LOG_debug (CON_DIR_LOG, ">> got file entry: %s %"G_GUINT64_FORMAT, name, entry->bytes);
+        dir_tree_update_entry (dir_req->dir_tree, dir_req->dir_path, DET_file, dir_req->ino, name, entry->bytes, 
+            entry->last_modified, etag);
     }
 
-  //  LOG_debug (CON_DIR_LOG, "DIR LIST: =============\n%s\n=============", xml);
-
-    root_element = xmlDocGetRootElement (xmlctx->myDoc);
-    for (onode = root_element->children; onode; onode = onode->next) {
-        gboolean is_object;
-        gboolean is_subdir;
-
-        if (onode->type != XML_ELEMENT_NODE) continue;
-
-        is_object = !strcasecmp((const char *)onode->name, "object");
-        is_subdir = !strcasecmp((const char *)onode->name, "subdir");
-        
-        // file
-        if (is_object) {
-            off_t size = 0;
-            name = NULL;
-
-            for (anode = onode->children; anode; anode = anode->next) {
-                char *content = NULL;
-                
-                for (text_node = anode->children; text_node; text_node = text_node->next) {
-                    if (text_node->type == XML_TEXT_NODE)
-                      content = (char *)text_node->content;
-                }
-
-                if (!strcasecmp((const char *)anode->name, "name") && content) {
-                    name = g_path_get_basename (content);
-                }
-
-                if (!strcasecmp((const char *)anode->name, "bytes") && content)
-                    size = strtoll (content, NULL, 10);
-
-                if (!strcasecmp((const char *)anode->name, "content_type") && content) {
-                }
-
-                if (!strcasecmp((const char *)anode->name, "last_modified") && content) {
-                    struct tm tmp = {0};
-                    strptime (content, "%FT%T", &tmp);
-                    last_modified = mktime (&tmp);
-                }
-            }
+    g_free (name);
+}
 
-            if (name) {
-                LOG_debug (CON_DIR_LOG, ">> got file entry: %s %zu", name, size);
-                dir_tree_update_entry (dir_list->dir_tree, dir_list->dir_path, DET_file, dir_list->ino, name, size, last_modified);
-                g_free (name);
-            }
+// prepare parser for a new listing page
+static void dir_req_page_start (DirListRequest *dir_req)
+{
+    if (dir_req->parser)
+        hfs_dir_list_parser_destroy (dir_req->parser);
 
-        // directory
-        } else if (is_subdir) {
-            //char * slash;
-            name = NULL;
+    dir_req->parser = hfs_dir_list_parser_create (dir_req->format, dir_req_on_entry_cb, dir_req);
+    dir_req->page_entries = 0;
+    g_free (dir_req->last_name);
+    dir_req->last_name = NULL;
+}
 
-            for (anode = onode->children; anode; anode = anode->next) {
-                char *content = NULL;
-                
-                for (text_node = anode->children; text_node; text_node = text_node->next) {
-                    if (text_node->type == XML_TEXT_NODE)
-                      content = (char *)text_node->content;
-                }
+// a part of listing page is received
+static void dir_req_on_chunk_cb (G_GNUC_UNUSED HttpConnection *con, gpointer ctx, const gchar *buf, size_t buf_len)
+{
+    DirListRequest *dir_req = (DirListRequest *) ctx;
 
-                if (!strcasecmp((const char *)anode->name, "name") && content) {
-                    name = g_path_get_basename (content);
-                }
+    if (dir_req->parser)
+        hfs_dir_list_parser_feed (dir_req->parser, buf, buf_len);
+}
 
-            }
+// parse the rest of listing page
+// reutrns TRUE if page is well-formed
+static gboolean dir_req_page_end (DirListRequest *dir_req, const char *buf, size_t buf_len)
+{
+    gboolean res;
 
-            if (name) {
-                LOG_debug (CON_DIR_LOG, ">> got dir entry: %s", name);
-                dir_tree_update_entry (dir_list->dir_tree, dir_list->dir_path, DET_dir, dir_list->ino, name, 0, last_modified);
-                g_free (name);
-            }
-        } else {
-            LOG_debug (CON_DIR_LOG, "unknown element: %s", onode->name);
-        }
+    if (!dir_req->parser)
+        return FALSE;
+
+    res = hfs_dir_list_parser_feed (dir_req->parser, buf, buf_len) && 
+        hfs_dir_list_parser_finish (dir_req->parser);
+
+    hfs_dir_list_parser_destroy (dir_req->parser);
+    dir_req->parser = NULL;
+
+    if (!res)
+        LOG_err (CON_DIR_LOG, "Failed to parse directory !");
+
+    return res;
+}
+
+// returns marker of the next page, or NULL if this page is the last one
+static gchar *dir_req_get_next_marker (DirListRequest *dir_req)
+{
+    return hfs_dir_list_next_marker (dir_req->last_name, dir_req->page_entries, dir_req->page_size);
+}
+/*}}}*/
+
+// send request for the listing page which starts after "marker" (NULL for the first page)
+static gboolean dir_req_get_page (DirListRequest *dir_req, const gchar *marker)
+{
+    GString *req_path;
+    gboolean res;
+
+    req_path = g_string_new (NULL);
+    g_string_printf (req_path, "/%s?delimiter=/&prefix=%s&limit=%u&format=%s", 
+        application_get_container_name (dir_req->app), dir_req->dir_path, dir_req->page_size,
+        hfs_dir_list_format_to_string (dir_req->format));
+
+    if (marker) {
+        g_string_append (req_path, "&marker=");
+        g_string_append_uri_escaped (req_path, marker, NULL, FALSE);
+    }
+
+    if (dir_req->end_marker) {
+        g_string_append (req_path, "&end_marker=");
+        g_string_append_uri_escaped (req_path, dir_req->end_marker, NULL, FALSE);
     }
 
-    xmlFreeDoc (xmlctx->myDoc);
-    xmlFreeParserCtxt (xmlctx);
+    // entries are added to DirTree as response body arrives
+    dir_req_page_start (dir_req);
+    http_connection_set_chunk_cb (dir_req->con, dir_req_on_chunk_cb);
 
-    return TRUE;
+    res = http_connection_make_request_to_storage_url (dir_req->con, 
+        req_path->str, "GET", NULL,
+        http_connection_on_directory_listing_data,
+        dir_req
+    );
+    g_string_free (req_path, TRUE);
+
+    return res;
+}
+
+// create listing of partition (start_marker, end_marker), markers are full names
+static DirListRequest *dir_req_create (DirListJob *job, Application *app, const gchar *dir_path,
+    const gchar *start_marker, const gchar *end_marker)
+{
+    DirListRequest *dir_req;
+
+    dir_req = g_new0 (DirListRequest, 1);
+    dir_req->job = job;
+    dir_req->app = app;
+    dir_req->dir_tree = job->dir_tree;
+    dir_req->ino = job->ino;
+    dir_req->dir_path = g_strdup (dir_path);
+    dir_req->page_size = conf_get_uint (application_get_conf (app), "filesystem.dir_list_page_size");
+    if (!dir_req->page_size)
+        dir_req->page_size = 1;
+    dir_req->start_marker = g_strdup (start_marker);
+    dir_req->end_marker = g_strdup (end_marker);
+    dir_req->format = hfs_dir_list_format_from_string (conf_get_string (application_get_conf (app), "filesystem.dir_list_format"));
+
+    return dir_req;
 }
 
 static void dir_req_free (DirListRequest *dir_req)
 {
     g_free (dir_req->dir_path);
+    g_free (dir_req->start_marker);
+    g_free (dir_req->end_marker);
+    if (dir_req->parser)
+        hfs_dir_list_parser_destroy (dir_req->parser);
+    g_free (dir_req->last_name);
     g_free (dir_req);
 }
 
+// drop a reference: a partition is listed, or all partitions are started
+// directory update is finished when references are dropped
+static void dir_list_job_unref (DirListJob *job)
+{
+    job->parts_left--;
+    if (!job->parts_left) {
+        LOG_debug (CON_DIR_LOG, "DONE !!");
+
+        // we are done, stop updating
+        // entries which were not found are removed before directory buffer is filled
+        dir_tree_stop_update (job->dir_tree, job->ino, job->age, job->success);
+
+        if (job->directory_listing_callback)
+            job->directory_listing_callback (job->callback_data, job->success);
+
+        g_free (job);
+    }
+}
+
+// partition is listed
+static void dir_req_done (HttpConnection *con, DirListRequest *dir_req, gboolean success)
+{
+    DirListJob *job = dir_req->job;
+
+    if (!success)
+        job->success = FALSE;
+
+    dir_list_job_unref (job);
+
+    // release HTTP client
+    http_connection_release (con);
+
+    dir_req_free (dir_req);
+}
+
 // error, return error to fuse 
 static void http_connection_on_directory_listing_error (HttpConnection *con, void *ctx)
 {
@@ -147,147 +251,159 @@ static void http_connection_on_directory_listing_error (HttpConnection *con, voi
     
     LOG_err (CON_DIR_LOG, "Failed to retrieve directory listing !");
 
-    // we are done, stop updating
-    dir_tree_stop_update (dir_req->dir_tree, dir_req->ino);
-    
-    if (dir_req->directory_listing_callback)
-        dir_req->directory_listing_callback (dir_req->callback_data, FALSE);
-
-    // release HTTP client
-    http_connection_release (con);
-    
-    dir_req_free (dir_req);
+    dir_req_done (con, dir_req, FALSE);
 }
 
 // Directory read callback function
+// entries are already added to DirTree while page was being received,
+// the next page is requested right after the end of this page is parsed
 static void http_connection_on_directory_listing_data (HttpConnection *con, void *ctx, 
     const gchar *buf, size_t buf_len, 
     G_GNUC_UNUSED struct evkeyvalq *headers, gboolean success)
 {   
     DirListRequest *dir_req = (DirListRequest *) ctx;
-    const gchar *next_marker = FALSE;
-    gchar *req_path;
-    gboolean res;
+    gchar *next_marker;
    
-    if (!buf_len || !success) {
-        LOG_debug (CON_DIR_LOG, "Directory buffer is empty !");
-        //http_connection_on_directory_listing_error (con, (void *) dir_req);
-        if (dir_req->directory_listing_callback)
-            dir_req->directory_listing_callback (dir_req->callback_data, TRUE);
-        
-        // we are done, stop updating
-        dir_tree_stop_update (dir_req->dir_tree, dir_req->ino);
-        
-        // release HTTP client
-        http_connection_release (con);
+    // failed request: entries which were not received must not be removed from DirTree
+    if (!success) {
+        http_connection_on_directory_listing_error (con, (void *) dir_req);
+        return;
+    }
 
-        dir_req_free (dir_req);
-        
+    // 204 No Content: directory is empty
+    if (con->response_code == 204) {
+        LOG_debug (CON_DIR_LOG, "Directory buffer is empty !");
+        dir_req_done (con, dir_req, TRUE);
         return;
     }
    
-    if (!parse_dir_xml (dir_req, buf, buf_len)) {
-
+    // body is passed to parser by chunks, an empty or truncated page is malformed
+    if (!dir_req_page_end (dir_req, buf, buf_len)) {
         LOG_err (CON_DIR_LOG, "Failed to parse directory data !");
-        
-        if (dir_req->directory_listing_callback)
-            dir_req->directory_listing_callback (dir_req->callback_data, TRUE);
-
-        // we are done, stop updating
-        dir_tree_stop_update (dir_req->dir_tree, dir_req->ino);
-        
-        // release HTTP client
-        http_connection_release (con);
-
-        dir_req_free (dir_req);
+        dir_req_done (con, dir_req, FALSE);
         return;
     }
 
-        // check if we need to get more data
+    // check if we need to get more data
+    next_marker = dir_req_get_next_marker (dir_req);
     if (!next_marker) {
-        LOG_debug (CON_DIR_LOG, "DONE !!");
-        
-        if (dir_req->directory_listing_callback)
-            dir_req->directory_listing_callback (dir_req->callback_data, TRUE);
-        
-        // we are done, stop updating
-        dir_tree_stop_update (dir_req->dir_tree, dir_req->ino);
-        
-        // release HTTP client
-        http_connection_release (con);
-
-        dir_req_free (dir_req);
+        dir_req_done (con, dir_req, TRUE);
         return;
     }
 
-    // execute HTTP request
-    req_path = g_strdup_printf ("/%s?delimiter=/&prefix=%s&max-keys=%d&marker=%s&format=xml", 
-        application_get_container_name (con->app), dir_req->dir_path, dir_req->max_keys, next_marker);
-    
-    res = http_connection_make_request_to_storage_url (dir_req->con, 
-        req_path, "GET", NULL,
-        http_connection_on_directory_listing_data,
-        dir_req
-    );
-    g_free (req_path);
+    LOG_debug (CON_DIR_LOG, "Requesting the next page, marker: %s", next_marker);
+    if (!dir_req_get_page (dir_req, next_marker)) {
+        LOG_err (CON_DIR_LOG, "Failed to create HTTP request !");
+        http_connection_on_directory_listing_error (con, (void *) dir_req);
+    }
+    g_free (next_marker);
+}
+
+// got HTTP client from ops pool, start listing partition
+static void dir_req_on_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    DirListRequest *dir_req = (DirListRequest *) ctx;
+
+    http_connection_acquire (con);
+    dir_req->con = con;
+
+    LOG_debug (CON_DIR_LOG, "Listing partition: %s ..", dir_req->start_marker);
 
-    if (!res) {
+    if (!dir_req_get_page (dir_req, dir_req->start_marker)) {
         LOG_err (CON_DIR_LOG, "Failed to create HTTP request !");
         http_connection_on_directory_listing_error (con, (void *) dir_req);
-        return;
     }
 }
 
 // create DirListRequest
+// if directory was large when it was listed last time, it's split into "filesystem.dir_list_partitions"
+// key ranges, which are listed in parallel using connections from ops pool
 gboolean http_connection_get_directory_listing (HttpConnection *con, const gchar *dir_path, fuse_ino_t ino,
     HttpConnection_directory_listing_callback directory_listing_callback, gpointer callback_data)
 {
+    Application *app = http_connection_get_app (con);
+    ConfData *conf = application_get_conf (app);
+    DirListJob *job;
     DirListRequest *dir_req;
-    gchar *req_path;
-    gboolean res;
+    gchar *full_path;
+    gchar *end_marker = NULL;
+    gchar **boundaries = NULL;
+    guint parts;
 
     LOG_debug (CON_DIR_LOG, "Getting directory listing for: %s", dir_path);
 
-    dir_req = g_new0 (DirListRequest, 1);
-    dir_req->con = con;
-    dir_req->app = http_connection_get_app (con);
-    dir_req->dir_tree = application_get_dir_tree (dir_req->app);
-    dir_req->ino = ino;
-    // XXX: settings
-    dir_req->max_keys = 1000;
-    dir_req->directory_listing_callback = directory_listing_callback;
-    dir_req->callback_data = callback_data;
+    job = g_new0 (DirListJob, 1);
+    job->dir_tree = application_get_dir_tree (app);
+    job->ino = ino;
+    job->success = TRUE;
+    job->directory_listing_callback = directory_listing_callback;
+    job->callback_data = callback_data;
+    // partition can fail synchronously when it's started, job is kept until all partitions are started
+    job->parts_left = 1;
 
     // acquire HTTP client
     http_connection_acquire (con);
     
-    // inform that we started to update the directory
-    dir_tree_start_update (dir_req->dir_tree, dir_path);
+    // inform that we started to update the directory, all partitions share the same generation
+    job->age = dir_tree_start_update (job->dir_tree, ino);
     
     //XXX: fix dir_path
     if (!strcmp (dir_path, "")) {
-        dir_req->dir_path = g_strdup ("");
+        full_path = g_strdup ("");
     } else {
-        dir_req->dir_path = g_strdup_printf ("%s/", dir_path);
+        full_path = g_strdup_printf ("%s/", dir_path);
     }
-   
-    req_path = g_strdup_printf ("/%s?delimiter=/&prefix=%s&max-keys=%d&format=xml", 
-        application_get_container_name (con->app), dir_req->dir_path, dir_req->max_keys);
 
-    res = http_connection_make_request_to_storage_url (con, 
-        req_path, "GET", NULL,
-        http_connection_on_directory_listing_data,
-        dir_req
-    );
-    
-    g_free (req_path);
+    // each partition should contain at least one full page
+    parts = conf_get_uint (conf, "filesystem.dir_list_partitions");
+    if (parts > 1)
+        boundaries = dir_tree_get_listing_boundaries (job->dir_tree, ino, parts, 
+            parts * conf_get_uint (conf, "filesystem.dir_list_page_size"));
+
+    // the last partitions are started first:
+    // if HTTP client can't be acquired, the range is listed by the previous partition
+    if (boundaries) {
+        guint i;
+
+        for (i = g_strv_length (boundaries); i > 0; i--) {
+            gchar *start_marker = g_strdup_printf ("%s%s", full_path, boundaries[i - 1]);
+
+            dir_req = dir_req_create (job, app, full_path, start_marker, end_marker);
+            job->parts_left++;
+            if (!client_pool_get_client (application_get_ops_client_pool (app), dir_req_on_con_cb, dir_req)) {
+                LOG_debug (CON_DIR_LOG, "Failed to get HTTP client, partition is merged with the previous one !");
+                job->parts_left--;
+                dir_req_free (dir_req);
+                g_free (start_marker);
+                continue;
+            }
+
+            // server returns names after "marker" and before "end_marker":
+            // the previous partition ends right after the boundary name
+            g_free (end_marker);
+            end_marker = g_strdup_printf ("%s\x01", start_marker);
+            g_free (start_marker);
+        }
+        LOG_debug (CON_DIR_LOG, "Listing %s in %u partitions", dir_path, job->parts_left);
+        g_strfreev (boundaries);
+    }
 
-    if (!res) {
+    dir_req = dir_req_create (job, app, full_path, NULL, end_marker);
+    dir_req->con = con;
+    job->parts_left++;
+    g_free (end_marker);
+    g_free (full_path);
+   
+    if (!dir_req_get_page (dir_req, NULL)) {
         LOG_err (CON_DIR_LOG, "Failed to create HTTP request !");
+        // frees dir_req
         http_connection_on_directory_listing_error (con, (void *) dir_req);
-        dir_req_free (dir_req);
+        dir_list_job_unref (job);
         return FALSE;
     }
 
+    dir_list_job_unref (job);
+
     return TRUE;
 }
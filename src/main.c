@@ -155,6 +155,11 @@ SSL_CTX *application_get_ssl_ctx (Application *app)
     return app->ssl_ctx;
 }
 
+HfsFuse *application_get_hfs_fuse (Application *app)
+{
+    return app->hfs_fuse;
+}
+
 
 /*}}}*/
 
@@ -339,6 +344,9 @@ static void application_on_connection_client_cb (gpointer client, gpointer ctx)
 
 static void application_destroy (Application *app)
 {
+    // callbacks of pending disk operations can still use client pools
+    if (app->cmng)
+        cache_mng_destroy (app->cmng);
 
     if (app->read_client_pool)
         client_pool_destroy (app->read_client_pool);
@@ -352,9 +360,6 @@ static void application_destroy (Application *app)
     if (app->dir_tree)
         dir_tree_destroy (app->dir_tree);
 
-    if (app->cmng)
-        cache_mng_destroy (app->cmng);
-
     if (app->sigint_ev)
         event_free (app->sigint_ev);
     if (app->sigpipe_ev)
@@ -594,14 +599,33 @@ int main (int argc, char *argv[])
         conf_add_int (app->conf, "connection.retries", -1);
 
         conf_add_uint (app->conf, "filesystem.dir_cache_max_time", 5);
+        conf_add_uint (app->conf, "filesystem.dir_list_page_size", 10000);
+        conf_add_uint (app->conf, "filesystem.dir_list_partitions", 1);
+        conf_add_string (app->conf, "filesystem.dir_list_format", "xml");
         conf_add_boolean (app->conf, "filesystem.cache_enabled", TRUE);
         conf_add_boolean (app->conf, "filesystem.md5_enabled", FALSE);
         conf_add_string (app->conf, "filesystem.cache_dir", "/tmp/hydrafs");
         conf_add_string (app->conf, "filesystem.cache_dir_max_size", "1Gb");
+        conf_add_boolean (app->conf, "filesystem.cache_persistent", TRUE);
+        conf_add_string (app->conf, "filesystem.cache_memory_size", "64Mb");
+        conf_add_uint (app->conf, "filesystem.cache_io_threads", 4);
         conf_add_uint (app->conf, "filesystem.segment_size", 5242880); // 5mb
+        conf_add_uint (app->conf, "filesystem.read_block_size", 1048576); // 1mb
+        conf_add_boolean (app->conf, "filesystem.full_object_download", FALSE);
+        conf_add_uint (app->conf, "filesystem.parallel_downloads", 3);
+        conf_add_uint (app->conf, "filesystem.readahead_uploads", 3);
         conf_add_uint (app->conf, "filesystem.cache_object_ttl", 600); // 10 min
         conf_add_uint (app->conf, "filesystem.cache_check_secs", 60); // 1 min
 
+        conf_add_uint (app->conf, "fuse.requests_per_wakeup", 64);
+        conf_add_uint (app->conf, "fuse.entry_timeout", 1);
+        conf_add_uint (app->conf, "fuse.attr_timeout", 1);
+        conf_add_uint (app->conf, "fuse.negative_timeout", 1);
+        conf_add_uint (app->conf, "fuse.max_write", 1048576); // 1mb
+        conf_add_uint (app->conf, "fuse.max_readahead", 1048576); // 1mb
+        conf_add_boolean (app->conf, "fuse.writeback_cache", FALSE);
+        conf_add_boolean (app->conf, "fuse.passthrough", TRUE);
+
         conf_add_boolean (app->conf, "encryption.enabled", FALSE);
         conf_add_string (app->conf, "encryption.key_file", "");
 
@@ -289,3 +289,31 @@ const gchar *bytes_get_string (guint64 bytes)
     return out;
 }
 
+
+// parse size string, such as "1Gb", "512Mb", "100Kb" or "1024"
+guint64 bytes_from_string (const gchar *str)
+{
+    gchar *end = NULL;
+    guint64 bytes;
+
+    if (!str)
+        return 0;
+
+    bytes = g_ascii_strtoull (str, &end, 10);
+    while (end && g_ascii_isspace (*end))
+        end++;
+
+    if (!end || !*end)
+        return bytes;
+
+    switch (g_ascii_toupper (*end)) {
+        case 'G':
+            return bytes * GB;
+        case 'M':
+            return bytes * MB;
+        case 'K':
+            return bytes * KB;
+        default:
+            return bytes;
+    }
+}
@@ -0,0 +1,313 @@
+/*  
+ * Copyright 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "hfs_dir_list_parser.h"
+
+// parsed entries
+typedef struct {
+    GPtrArray *names;
+    GPtrArray *hashes;
+    guint64 bytes;
+    guint subdirs;
+} DirListTest;
+
+static const gchar *xml_listing =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<container name=\"test\">"
+    "<object><name>dir/a &amp; b</name><hash>d41d8cd98f00b204e9800998ecf8427e</hash><bytes>1234</bytes>"
+    "<content_type>text/plain</content_type><last_modified>2013-01-15T16:41:49.390270</last_modified></object>"
+    "<subdir name=\"dir/sub/\"><name>dir/sub/</name></subdir>"
+    "<object><name>dir/z</name><hash>9e107d9d372bb6826bd81d3542a419d6</hash><bytes>5</bytes>"
+    "<content_type>text/plain</content_type><last_modified>2013-01-15T16:41:49.390270</last_modified></object>"
+    "</container>";
+
+static const gchar *json_listing =
+    "[{\"hash\": \"d41d8cd98f00b204e9800998ecf8427e\", \"last_modified\": \"2013-01-15T16:41:49.390270\", "
+    "\"bytes\": 1234, \"name\": \"dir/a & b\", \"content_type\": \"text/plain\"}, "
+    "{\"subdir\": \"dir/sub/\"}, "
+    "{\"hash\": \"9e107d9d372bb6826bd81d3542a419d6\", \"last_modified\": \"2013-01-15T16:41:49.390270\", "
+    "\"bytes\": 5, \"name\": \"dir/z\", \"content_type\": \"text/plain\"}]";
+
+static void hfs_dir_list_test_setup (DirListTest *test, gconstpointer test_data)
+{
+    test->names = g_ptr_array_new_with_free_func (g_free);
+    test->hashes = g_ptr_array_new_with_free_func (g_free);
+    test->bytes = 0;
+    test->subdirs = 0;
+}
+
+static void hfs_dir_list_test_destroy (DirListTest *test, gconstpointer test_data)
+{
+    g_ptr_array_free (test->names, TRUE);
+    g_ptr_array_free (test->hashes, TRUE);
+}
+
+static void hfs_dir_list_test_on_entry_cb (gpointer ctx, const HfsDirListEntry *entry)
+{
+    DirListTest *test = (DirListTest *) ctx;
+
+    g_ptr_array_add (test->names, g_strdup (entry->name));
+    g_ptr_array_add (test->hashes, g_strdup (entry->hash));
+    test->bytes += entry->bytes;
+    if (entry->is_subdir)
+        test->subdirs++;
+}
+
+// feed listing by chunks of "chunk_size" bytes, return TRUE if listing is parsed
+static gboolean hfs_dir_list_test_parse (DirListTest *test, HfsDirListFormat format,
+    const gchar *buf, size_t buf_len, size_t chunk_size)
+{
+    HfsDirListParser *parser;
+    size_t off;
+    gboolean res = TRUE;
+
+    g_ptr_array_set_size (test->names, 0);
+    g_ptr_array_set_size (test->hashes, 0);
+    test->bytes = 0;
+    test->subdirs = 0;
+
+    parser = hfs_dir_list_parser_create (format, hfs_dir_list_test_on_entry_cb, test);
+    for (off = 0; off < buf_len && res; off += chunk_size)
+        res = hfs_dir_list_parser_feed (parser, buf + off, MIN (chunk_size, buf_len - off));
+    if (res)
+        res = hfs_dir_list_parser_finish (parser);
+    hfs_dir_list_parser_destroy (parser);
+
+    return res;
+}
+
+static void hfs_dir_list_test_check (DirListTest *test)
+{
+    g_assert_cmpuint (test->names->len, ==, 3);
+    g_assert_cmpstr (g_ptr_array_index (test->names, 0), ==, "dir/a & b");
+    g_assert_cmpstr (g_ptr_array_index (test->names, 1), ==, "dir/sub/");
+    g_assert_cmpstr (g_ptr_array_index (test->names, 2), ==, "dir/z");
+    g_assert_cmpstr (g_ptr_array_index (test->hashes, 0), ==, "d41d8cd98f00b204e9800998ecf8427e");
+    g_assert (g_ptr_array_index (test->hashes, 1) == NULL);
+    g_assert_cmpuint (test->bytes, ==, 1239);
+    g_assert_cmpuint (test->subdirs, ==, 1);
+}
+
+static void hfs_dir_list_test_xml (DirListTest *test, gconstpointer test_data)
+{
+    g_assert (hfs_dir_list_test_parse (test, DLF_xml, xml_listing, strlen (xml_listing), strlen (xml_listing)));
+    hfs_dir_list_test_check (test);
+}
+
+static void hfs_dir_list_test_json (DirListTest *test, gconstpointer test_data)
+{
+    g_assert (hfs_dir_list_test_parse (test, DLF_json, json_listing, strlen (json_listing), strlen (json_listing)));
+    hfs_dir_list_test_check (test);
+}
+
+// listing is received in parts, which can end at any byte
+static void hfs_dir_list_test_chunks (DirListTest *test, gconstpointer test_data)
+{
+    size_t chunk_size;
+
+    for (chunk_size = 1; chunk_size < strlen (xml_listing); chunk_size++) {
+        g_assert (hfs_dir_list_test_parse (test, DLF_xml, xml_listing, strlen (xml_listing), chunk_size));
+        hfs_dir_list_test_check (test);
+    }
+
+    for (chunk_size = 1; chunk_size < strlen (json_listing); chunk_size++) {
+        g_assert (hfs_dir_list_test_parse (test, DLF_json, json_listing, strlen (json_listing), chunk_size));
+        hfs_dir_list_test_check (test);
+    }
+}
+
+static void hfs_dir_list_test_json_escape (DirListTest *test, gconstpointer test_data)
+{
+    const gchar *json =
+        "[{\"name\": \"dir/\\\"quoted\\\" \\/ \\u00e9 \\ud83d\\ude00 name\", \"bytes\": 1, "
+        "\"extra\": {\"list\": [1, \"}]\", null, true]}}]";
+    size_t chunk_size;
+
+    for (chunk_size = 1; chunk_size <= strlen (json); chunk_size++) {
+        g_assert (hfs_dir_list_test_parse (test, DLF_json, json, strlen (json), chunk_size));
+        g_assert_cmpuint (test->names->len, ==, 1);
+        g_assert_cmpstr (g_ptr_array_index (test->names, 0), ==, "dir/\"quoted\" / \xc3\xa9 \xf0\x9f\x98\x80 name");
+        g_assert_cmpuint (test->bytes, ==, 1);
+    }
+}
+
+static void hfs_dir_list_test_malformed (DirListTest *test, gconstpointer test_data)
+{
+    g_assert (hfs_dir_list_test_parse (test, DLF_json, "[]", 2, 1));
+    g_assert_cmpuint (test->names->len, ==, 0);
+
+    g_assert (!hfs_dir_list_test_parse (test, DLF_json, "{}", 2, 2));
+    g_assert (!hfs_dir_list_test_parse (test, DLF_json, "[{\"name\" 1}]", 12, 12));
+    // truncated listing
+    g_assert (!hfs_dir_list_test_parse (test, DLF_json, json_listing, strlen (json_listing) - 1, 100));
+    g_assert (!hfs_dir_list_test_parse (test, DLF_xml, xml_listing, strlen (xml_listing) - 1, 100));
+}
+
+// the first page is empty, cut off before the first entry or isn't a listing
+static void hfs_dir_list_test_malformed_first_page (DirListTest *test, gconstpointer test_data)
+{
+    const gchar *json_pages[] = { "", "[", "[{\"name\": \"dir/a", "<html></html>", NULL };
+    const gchar *xml_pages[] = { "", "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<container name=\"test\">",
+        "<html><body>Service Unavailable</body></html>", "[]", NULL };
+    guint i;
+
+    for (i = 0; json_pages[i]; i++) {
+        g_assert (!hfs_dir_list_test_parse (test, DLF_json, json_pages[i], strlen (json_pages[i]), 1));
+        g_assert_cmpuint (test->names->len, ==, 0);
+    }
+
+    for (i = 0; xml_pages[i]; i++) {
+        g_assert (!hfs_dir_list_test_parse (test, DLF_xml, xml_pages[i], strlen (xml_pages[i]), 1));
+        g_assert_cmpuint (test->names->len, ==, 0);
+    }
+}
+
+// JSON listing page of "objects" as server returns it for "delimiter=/&limit=page_size&marker=marker":
+// objects under a subdir are collapsed into one subdir entry, which isn't returned again if it's the marker
+static GString *hfs_dir_list_test_server_page (const gchar **objects, const gchar *marker, guint page_size)
+{
+    GString *page;
+    guint entries = 0;
+    guint i;
+
+    page = g_string_new ("[");
+    for (i = 0; objects[i] && entries < page_size; i++) {
+        const gchar *slash;
+
+        if (marker && strcmp (objects[i], marker) <= 0)
+            continue;
+
+        slash = strchr (objects[i], '/');
+        if (slash) {
+            gchar *subdir = g_strndup (objects[i], slash - objects[i] + 1);
+
+            // skip the rest of objects in subdir
+            while (objects[i + 1] && g_str_has_prefix (objects[i + 1], subdir))
+                i++;
+
+            if (!marker || strcmp (subdir, marker)) {
+                g_string_append_printf (page, "%s{\"subdir\": \"%s\"}", entries ? ", " : "", subdir);
+                entries++;
+            }
+            g_free (subdir);
+            continue;
+        }
+
+        g_string_append_printf (page, "%s{\"name\": \"%s\", \"bytes\": 1}", entries ? ", " : "", objects[i]);
+        entries++;
+    }
+    g_string_append (page, "]");
+
+    return page;
+}
+
+// subdir "x/" is the last entry of a page, "x0" follows all "x/..." objects
+static void hfs_dir_list_test_next_marker (DirListTest *test, gconstpointer test_data)
+{
+    const gchar *objects[] = { "x/", "x/a", "x/b", "x0", NULL };
+    GPtrArray *names;
+    gchar *marker = NULL;
+    guint page_size = 1;
+    guint pages = 0;
+
+    names = g_ptr_array_new_with_free_func (g_free);
+    do {
+        GString *page = hfs_dir_list_test_server_page (objects, marker, page_size);
+
+        g_assert (hfs_dir_list_test_parse (test, DLF_json, page->str, page->len, page->len));
+        g_string_free (page, TRUE);
+        if (test->names->len)
+            g_ptr_array_add (names, g_strdup (g_ptr_array_index (test->names, test->names->len - 1)));
+
+        g_free (marker);
+        marker = hfs_dir_list_next_marker (test->names->len ? g_ptr_array_index (test->names, test->names->len - 1) : NULL,
+            test->names->len, page_size);
+        g_assert_cmpuint (++pages, <, 10);
+    } while (marker);
+
+    g_assert_cmpuint (names->len, ==, 2);
+    g_assert_cmpstr (g_ptr_array_index (names, 0), ==, "x/");
+    g_assert_cmpstr (g_ptr_array_index (names, 1), ==, "x0");
+
+    g_ptr_array_free (names, TRUE);
+}
+
+// 100k entries listing page in both formats, fed by 16Kb parts as it's received from server
+// run only in performance mode: -m perf
+static void hfs_dir_list_test_bench (DirListTest *test, gconstpointer test_data)
+{
+    GString *xml;
+    GString *json;
+    GTimer *timer;
+    guint i;
+    guint items = 100000;
+    gdouble xml_secs;
+    gdouble json_secs;
+    guint64 bytes;
+
+    xml = g_string_new ("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<container name=\"test\">");
+    json = g_string_new ("[");
+
+    for (i = 0; i < items; i++) {
+        g_string_append_printf (xml, "<object><name>directory/file_%08u.dat</name>"
+            "<hash>d41d8cd98f00b204e9800998ecf8427e</hash><bytes>%u</bytes>"
+            "<content_type>application/octet-stream</content_type>"
+            "<last_modified>2013-01-15T16:41:49.390270</last_modified></object>", i, i);
+        g_string_append_printf (json, "%s{\"hash\": \"d41d8cd98f00b204e9800998ecf8427e\", "
+            "\"last_modified\": \"2013-01-15T16:41:49.390270\", \"bytes\": %u, "
+            "\"name\": \"directory/file_%08u.dat\", \"content_type\": \"application/octet-stream\"}",
+            i ? ", " : "", i, i);
+    }
+    g_string_append (xml, "</container>");
+    g_string_append (json, "]");
+
+    timer = g_timer_new ();
+    g_assert (hfs_dir_list_test_parse (test, DLF_xml, xml->str, xml->len, 16 * 1024));
+    xml_secs = g_timer_elapsed (timer, NULL);
+    g_assert_cmpuint (test->names->len, ==, items);
+    bytes = test->bytes;
+
+    g_timer_start (timer);
+    g_assert (hfs_dir_list_test_parse (test, DLF_json, json->str, json->len, 16 * 1024));
+    json_secs = g_timer_elapsed (timer, NULL);
+    g_assert_cmpuint (test->names->len, ==, items);
+    g_assert_cmpuint (test->bytes, ==, bytes);
+    g_assert_cmpstr (g_ptr_array_index (test->names, items - 1), ==, "directory/file_00099999.dat");
+
+    g_test_message ("%u entries, XML: %zu bytes, JSON: %zu bytes", items, xml->len, json->len);
+    g_test_minimized_result (xml_secs, "XML: %.3f secs", xml_secs);
+    g_test_minimized_result (json_secs, "JSON: %.3f secs", json_secs);
+
+    g_timer_destroy (timer);
+    g_string_free (xml, TRUE);
+    g_string_free (json, TRUE);
+}
+
+int main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+
+	g_test_add ("/dir_list/dir_list_test_xml", DirListTest, 0, hfs_dir_list_test_setup, hfs_dir_list_test_xml, hfs_dir_list_test_destroy);
+	g_test_add ("/dir_list/dir_list_test_json", DirListTest, 0, hfs_dir_list_test_setup, hfs_dir_list_test_json, hfs_dir_list_test_destroy);
+	g_test_add ("/dir_list/dir_list_test_chunks", DirListTest, 0, hfs_dir_list_test_setup, hfs_dir_list_test_chunks, hfs_dir_list_test_destroy);
+	g_test_add ("/dir_list/dir_list_test_json_escape", DirListTest, 0, hfs_dir_list_test_setup, hfs_dir_list_test_json_escape, hfs_dir_list_test_destroy);
+	g_test_add ("/dir_list/dir_list_test_malformed", DirListTest, 0, hfs_dir_list_test_setup, hfs_dir_list_test_malformed, hfs_dir_list_test_destroy);
+	g_test_add ("/dir_list/dir_list_test_malformed_first_page", DirListTest, 0, hfs_dir_list_test_setup, hfs_dir_list_test_malformed_first_page, hfs_dir_list_test_destroy);
+	g_test_add ("/dir_list/dir_list_test_next_marker", DirListTest, 0, hfs_dir_list_test_setup, hfs_dir_list_test_next_marker, hfs_dir_list_test_destroy);
+	if (g_test_perf ())
+		g_test_add ("/dir_list/dir_list_test_bench", DirListTest, 0, hfs_dir_list_test_setup, hfs_dir_list_test_bench, hfs_dir_list_test_destroy);
+
+    return g_test_run ();
+}
@@ -51,6 +51,7 @@ static void hfs_range_test_extend_2 (HfsRange **range, gconstpointer test_data)
     hfs_range_add (*range, 7, 52);
     g_assert (hfs_range_contain (*range, 2, 12) == TRUE);
     g_assert (hfs_range_count (*range) == 2);
+    g_assert (hfs_range_length (*range) == 61);
     hfs_range_print (*range);
 }
 
@@ -104,6 +105,77 @@ static void hfs_range_test_remove_3 (HfsRange **range, gconstpointer test_data)
     hfs_range_print (*range);
 }
 
+static void hfs_range_test_query (HfsRange **range, gconstpointer test_data)
+{
+    GList *l_segments;
+    HfsRangeSegment *seg;
+
+    hfs_range_add (*range, 10, 20);
+    hfs_range_add (*range, 30, 40);
+
+    l_segments = hfs_range_query (*range, 5, 35);
+    g_assert (g_list_length (l_segments) == 4);
+    seg = (HfsRangeSegment *) g_list_nth_data (l_segments, 0);
+    g_assert (seg->start == 5 && seg->end == 10 && !seg->covered);
+    seg = (HfsRangeSegment *) g_list_nth_data (l_segments, 1);
+    g_assert (seg->start == 10 && seg->end == 20 && seg->covered);
+    seg = (HfsRangeSegment *) g_list_nth_data (l_segments, 2);
+    g_assert (seg->start == 20 && seg->end == 30 && !seg->covered);
+    seg = (HfsRangeSegment *) g_list_nth_data (l_segments, 3);
+    g_assert (seg->start == 30 && seg->end == 35 && seg->covered);
+    g_list_free_full (l_segments, g_free);
+
+    l_segments = hfs_range_query (*range, 12, 18);
+    g_assert (g_list_length (l_segments) == 1);
+    seg = (HfsRangeSegment *) g_list_nth_data (l_segments, 0);
+    g_assert (seg->start == 12 && seg->end == 18 && seg->covered);
+    g_list_free_full (l_segments, g_free);
+
+    l_segments = hfs_range_query (*range, 40, 50);
+    g_assert (g_list_length (l_segments) == 1);
+    seg = (HfsRangeSegment *) g_list_nth_data (l_segments, 0);
+    g_assert (seg->start == 40 && seg->end == 50 && !seg->covered);
+    g_list_free_full (l_segments, g_free);
+}
+
+// many small random writes, followed by lookups
+static void hfs_range_test_bench (HfsRange **range, gconstpointer test_data)
+{
+    GRand *rnd;
+    GTimer *timer;
+    guint i;
+    guint items = 100000;
+    guint found = 0;
+    gdouble add_secs;
+    gdouble lookup_secs;
+
+    rnd = g_rand_new_with_seed (1);
+    timer = g_timer_new ();
+
+    for (i = 0; i < items; i++) {
+        guint64 start = (guint64) g_rand_int_range (rnd, 0, 100000000);
+        hfs_range_add (*range, start, start + g_rand_int_range (rnd, 1, 512));
+    }
+    add_secs = g_timer_elapsed (timer, NULL);
+
+    g_timer_start (timer);
+    for (i = 0; i < items; i++) {
+        guint64 start = (guint64) g_rand_int_range (rnd, 0, 100000000);
+        if (hfs_range_contain (*range, start, start + 16))
+            found++;
+    }
+
+    lookup_secs = g_timer_elapsed (timer, NULL);
+
+    g_test_message ("%u intervals, %u lookups found: %u", hfs_range_count (*range), items, found);
+    g_test_minimized_result (add_secs, "%u adds: %.3f secs", items, add_secs);
+    g_test_minimized_result (lookup_secs, "%u lookups: %.3f secs", items, lookup_secs);
+
+    g_assert (hfs_range_count (*range) > 0);
+
+    g_timer_destroy (timer);
+    g_rand_free (rnd);
+}
 
 int main (int argc, char *argv[])
 {
@@ -115,6 +187,9 @@ int main (int argc, char *argv[])
 	g_test_add ("/range/range_test_add", HfsRange *, 0, hfs_range_test_setup, hfs_range_test_remove_1, hfs_range_test_destroy);
 	g_test_add ("/range/range_test_add", HfsRange *, 0, hfs_range_test_setup, hfs_range_test_remove_2, hfs_range_test_destroy);
 	g_test_add ("/range/range_test_add", HfsRange *, 0, hfs_range_test_setup, hfs_range_test_remove_3, hfs_range_test_destroy);
+	g_test_add ("/range/range_test_query", HfsRange *, 0, hfs_range_test_setup, hfs_range_test_query, hfs_range_test_destroy);
+	if (g_test_perf ())
+		g_test_add ("/range/range_test_bench", HfsRange *, 0, hfs_range_test_setup, hfs_range_test_bench, hfs_range_test_destroy);
 
     return g_test_run ();
 }